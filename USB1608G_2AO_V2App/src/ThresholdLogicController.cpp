@@ -48,6 +48,7 @@
 
 #include "ThresholdLogicController.h"
 #include "ErrorHandler.h"
+#include "measCompThreads.h"
 
 static const char *driverName = "ThresholdLogicController";
 
@@ -655,7 +656,7 @@ void ThresholdLogicController::startMonitoring()
             *this,                      // epicsThreadRunable 객체 (this)
             threadName,                 // 스레드 이름
             epicsThreadGetStackSize(epicsThreadStackMedium), // 스택 크기
-            epicsThreadPriorityMedium   // 중간 우선순위
+            measCompThreadPriority(threadName, epicsThreadPriorityMedium) // 기본값은 중간 우선순위
         );
         
         if (monitorThread_ == NULL) {
@@ -750,6 +751,9 @@ void ThresholdLogicController::run()
 {
     const char* functionName = "run";
     
+    // 설정된 스케줄링 정책과 CPU affinity 적용
+    measCompThreadApply(epicsThreadGetNameSelf());
+    
     // 스레드 시작 로그
     asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
               "%s::%s: 모니터링 스레드 시작 - PID: %lu\n",
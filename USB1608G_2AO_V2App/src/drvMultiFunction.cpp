@@ -14,9 +14,18 @@
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
 
 #include <iocsh.h>
 #include <epicsThread.h>
+#include <epicsEvent.h>
 #include <epicsString.h>
 
 #include <asynPortDriver.h>
@@ -29,9 +38,6 @@
   #include "uldaq.h"
 #endif
 
-// This needs to be global because we need to protect the UL library from simultaneous access from any driver
-epicsMutex ULMutex;
-
 // This function maps the Gain values from UL on Windows to the Range values in UL for Linux.
 // We can't use the macros from Windows cbw.h because they conflict with UL for Linux.
 // These definitions are taken from cbw.h, but added CBW_ prefix.
@@ -86,6 +92,8 @@ epicsMutex ULMutex;
 
 #include <epicsExport.h>
 #include <measCompDiscover.h>
+#include <measCompTiming.h>
+#include <measCompThreads.h>
 
 static const char *driverName = "MultiFunction";
 
@@ -98,6 +106,78 @@ typedef enum {
   waveTypeRandom
 } waveType_t;
 
+// Parameters that the last internal waveform in waveGenIntBuffer_ was synthesized from.
+// defineWaveform() skips regeneration and the array callback when these are unchanged.
+typedef struct {
+  int valid;
+  int waveType;
+  int numPoints;
+  double dwell;
+  double offset;
+  double amplitude;
+  double pulseWidth;
+} waveGenCache_t;
+
+// Waveform generator start sequence.  Preparation runs in waveGenThread without the port lock.
+typedef enum {
+  waveGenStateIdle,
+  waveGenStatePreparing,  // Synthesizing and converting the waveforms
+  waveGenStateArmed,      // Scan started, waiting for the external trigger
+  waveGenStateRunning
+} waveGenState_t;
+
+// How the waveform sequencer leaves a segment
+typedef enum {
+  waveSeqAdvanceComplete,  // After WAVESEQ_SEG_REPEAT repetitions, 0=forever
+  waveSeqAdvanceTrigger    // Repeat until WAVESEQ_TRIGGER or a rising edge on WAVESEQ_TRIGGER_BIT
+} waveSeqAdvance_t;
+
+// How the waveform generator and digitizer are started together in stimulus-response mode
+typedef enum {
+  waveSRSyncSoftware,    // Digitizer then generator, offset measured from the host clock
+  waveSRSyncExtTrigger,  // Both scans armed on the external trigger input
+  waveSRSyncExtClock     // Both scans paced by the external clock input
+} waveSRSync_t;
+
+// Segment definition, copied from the parameter library when the sequence starts
+typedef struct {
+  int waveType;
+  int numPoints;
+  int userStart;
+  double offset;
+  double amplitude;
+  int repeat;
+  int advance;
+  int next;
+  int jumpBit;
+  int jumpTarget;
+} waveSeqSegment_t;
+
+// The start of a segment, in absolute output points since the sequence started
+typedef struct {
+  epicsUInt64 point;
+  int segment;
+  int numPoints;
+} waveSeqBoundary_t;
+
+// Formats for user waveform files loaded with WAVEGEN_USER_FILE_LOAD or MultiFunctionLoadWaveform
+typedef enum {
+  waveFileFormatAuto,     // CSV if the name ends in .csv or .txt, otherwise float32
+  waveFileFormatFloat32,  // Raw native-endian 32-bit floats
+  waveFileFormatFloat64,  // Raw native-endian 64-bit floats
+  waveFileFormatCSV       // Numbers separated by commas or white space, # starts a comment line
+} waveFileFormat_t;
+
+typedef enum {
+  waveFileStatusIdle,
+  waveFileStatusLoading,
+  waveFileStatusDone,
+  waveFileStatusError
+} waveFileStatus_t;
+
+// Bytes processed between progress updates while loading a waveform file
+#define WAVE_FILE_CHUNK_SIZE 65536
+
 // Board parameters
 #define modelNameString           "MODEL_NAME"
 #define modelNumberString         "MODEL_NUMBER"
@@ -107,6 +187,23 @@ typedef enum {
 #define driverVersionString       "DRIVER_VERSION"
 #define pollSleepMSString         "POLL_SLEEP_MS"
 #define pollTimeMSString          "POLL_TIME_MS"
+#define pollPeriodMSString        "POLL_PERIOD_MS"
+#define pollPriorityString        "POLL_PRIORITY"
+#define pollActualMSString        "POLL_ACTUAL_MS"
+#define pollCallbacksSkippedString "POLL_CALLBACKS_SKIPPED"
+#define pollOverrunPolicyString   "POLL_OVERRUN_POLICY"
+#define pollJitterMeanMSString    "POLL_JITTER_MEAN_MS"
+#define pollJitterP99MSString     "POLL_JITTER_P99_MS"
+#define pollJitterMaxMSString     "POLL_JITTER_MAX_MS"
+#define pollOverrunsString        "POLL_OVERRUNS"
+#define scanEventsString          "SCAN_EVENTS"
+#define scanEventCountString      "SCAN_EVENT_COUNT"
+#define latencyHistWFString       "LATENCY_HIST_WF"
+#define latencyBinsWFString       "LATENCY_BINS_WF"
+#define latencyMeanUsString       "LATENCY_MEAN_US"
+#define latencyMaxUsString        "LATENCY_MAX_US"
+#define latencyCountString        "LATENCY_COUNT"
+#define latencyResetString        "LATENCY_RESET"
 #define lastErrorMessageString    "LAST_ERROR_MESSAGE"
 
 // Pulse output parameters
@@ -116,10 +213,42 @@ typedef enum {
 #define pulseGenDelayString       "PULSE_DELAY"
 #define pulseGenCountString       "PULSE_COUNT"
 #define pulseGenIdleStateString   "PULSE_IDLE_STATE"
+#define pulseGenCommitModeString  "PULSE_COMMIT_MODE"
+#define pulseGenCommitString      "PULSE_COMMIT"
+#define pulseGenCommitDelayMSString "PULSE_COMMIT_DELAY_MS"
+#define pulseGenPendingString     "PULSE_PENDING"
+#define pulseGenCommitLatencyMSString "PULSE_COMMIT_LATENCY_MS"
 
 // Counter parameters
 #define counterCountsString       "COUNTER_VALUE"
 #define counterResetString        "COUNTER_RESET"
+#define counterTotalString        "COUNTER_TOTAL"
+#define counterRateString         "COUNTER_RATE"
+#define counterRateEMAString      "COUNTER_RATE_EMA"
+#define counterRateWindowedString "COUNTER_RATE_WINDOWED"
+#define counterRateTauString      "COUNTER_RATE_TAU"
+#define counterRateWindowString   "COUNTER_RATE_WINDOW"
+
+// Counter scan parameters
+#define counterScanNumPointsString    "COUNTER_SCAN_NUM_POINTS"
+#define counterScanDwellString        "COUNTER_SCAN_DWELL"
+#define counterScanDwellActualString  "COUNTER_SCAN_DWELL_ACTUAL"
+#define counterScanExtTriggerString   "COUNTER_SCAN_EXT_TRIGGER"
+#define counterScanRunString          "COUNTER_SCAN_RUN"
+#define counterScanCurrentPointString "COUNTER_SCAN_CURRENT_POINT"
+#define counterScanTimeWFString       "COUNTER_SCAN_TIME_WF"
+#define counterScanCountsWFString     "COUNTER_SCAN_COUNTS_WF"
+#define counterScanRateWFString       "COUNTER_SCAN_RATE_WF"
+#define counterScanEncoderString      "COUNTER_SCAN_ENCODER"
+#define counterScanEncoderScaleString "COUNTER_SCAN_ENCODER_SCALE"
+#define counterScanDiffWidthString    "COUNTER_SCAN_DIFF_WIDTH"
+#define counterScanSmoothTauString    "COUNTER_SCAN_SMOOTH_TAU"
+#define counterScanPositionWFString   "COUNTER_SCAN_POSITION_WF"
+#define counterScanVelocityWFString   "COUNTER_SCAN_VELOCITY_WF"
+#define counterScanAccelWFString      "COUNTER_SCAN_ACCEL_WF"
+#define counterScanPositionString     "COUNTER_SCAN_POSITION"
+#define counterScanVelocityString     "COUNTER_SCAN_VELOCITY"
+#define counterScanAccelString        "COUNTER_SCAN_ACCEL"
 
 // Analog input parameters
 #define analogInValueString       "ANALOG_IN_VALUE"
@@ -127,10 +256,14 @@ typedef enum {
 #define analogInTypeString        "ANALOG_IN_TYPE"
 #define analogInModeString        "ANALOG_IN_MODE"
 #define analogInRateString        "ANALOG_IN_RATE"
+#define analogInBackgroundString  "ANALOG_IN_BACKGROUND"
+#define analogInBgRateString      "ANALOG_IN_BG_RATE"
+#define analogInAverageString     "ANALOG_IN_AVERAGE"
 
 // Voltage input parameters
 #define voltageInValueString      "VOLTAGE_IN_VALUE"
 #define voltageInRangeString      "VOLTAGE_IN_RANGE"
+#define voltageInCacheMaxAgeString "VOLTAGE_IN_CACHE_MAX_AGE"
 
 // Temperature parameters
 #define temperatureInValueString  "TEMPERATURE_IN_VALUE"
@@ -140,6 +273,11 @@ typedef enum {
 #define temperatureFilterString   "TEMPERATURE_FILTER"
 #define temperatureSensorString   "TEMPERATURE_SENSOR"
 #define temperatureWiringString   "TEMPERATURE_WIRING"
+#define temperatureCacheMaxAgeString "TEMPERATURE_CACHE_MAX_AGE"
+#define temperatureLPTauString    "TEMPERATURE_LP_TAU"
+#define temperatureMedianNString  "TEMPERATURE_MEDIAN_N"
+#define temperatureRateLimitString "TEMPERATURE_RATE_LIMIT"
+#define temperatureFilteredString "TEMPERATURE_FILTERED"
 
 // Waveform digitizer parameters - global
 #define waveDigDwellString        "WAVEDIG_DWELL"
@@ -160,6 +298,7 @@ typedef enum {
 #define waveDigTimeWFString       "WAVEDIG_TIME_WF"
 #define waveDigAbsTimeWFString    "WAVEDIG_ABS_TIME_WF"
 #define waveDigReadWFString       "WAVEDIG_READ_WF"
+#define waveDigEventPointsString  "WAVEDIG_EVENT_POINTS"
 // Waveform digitizer parameters - per input
 #define waveDigVoltWFString       "WAVEDIG_VOLT_WF"
 
@@ -184,6 +323,7 @@ typedef enum {
 #define waveGenRetriggerString    "WAVEGEN_RETRIGGER"
 #define waveGenTriggerCountString "WAVEGEN_TRIGGER_COUNT"
 #define waveGenRunString          "WAVEGEN_RUN"
+#define waveGenStateString        "WAVEGEN_STATE"
 #define waveGenUserTimeWFString   "WAVEGEN_USER_TIME_WF"
 #define waveGenIntTimeWFString    "WAVEGEN_INT_TIME_WF"
 // Waveform generator parameters - per output
@@ -194,6 +334,78 @@ typedef enum {
 #define waveGenPulseWidthString   "WAVEGEN_PULSE_WIDTH"
 #define waveGenIntWFString        "WAVEGEN_INT_WF"
 #define waveGenUserWFString       "WAVEGEN_USER_WF"
+#define waveGenUserFileString     "WAVEGEN_USER_FILE"
+#define waveGenUserFileFormatString   "WAVEGEN_USER_FILE_FORMAT"
+#define waveGenUserFileLoadString     "WAVEGEN_USER_FILE_LOAD"
+#define waveGenUserFileProgressString "WAVEGEN_USER_FILE_PROGRESS"
+#define waveGenUserFileChecksumString "WAVEGEN_USER_FILE_CHECKSUM"
+#define waveGenUserFileStatusString   "WAVEGEN_USER_FILE_STATUS"
+
+// Waveform sequencer parameters - global
+#define waveSeqRunString            "WAVESEQ_RUN"
+#define waveSeqDwellString          "WAVESEQ_DWELL"
+#define waveSeqDwellActualString    "WAVESEQ_DWELL_ACTUAL"
+#define waveSeqFirstSegmentString   "WAVESEQ_FIRST_SEGMENT"
+#define waveSeqRingPointsString     "WAVESEQ_RING_POINTS"
+#define waveSeqTriggerString        "WAVESEQ_TRIGGER"
+#define waveSeqTriggerBitString     "WAVESEQ_TRIGGER_BIT"
+#define waveSeqCurrentSegmentString "WAVESEQ_CURRENT_SEGMENT"
+#define waveSeqCurrentRepeatString  "WAVESEQ_CURRENT_REPEAT"
+#define waveSeqSegmentPointString   "WAVESEQ_SEGMENT_POINT"
+#define waveSeqUnderrunsString      "WAVESEQ_UNDERRUNS"
+// Waveform sequencer parameters - per segment
+#define waveSeqSegTypeString        "WAVESEQ_SEG_TYPE"
+#define waveSeqSegNumPointsString   "WAVESEQ_SEG_NUM_POINTS"
+#define waveSeqSegAmplitudeString   "WAVESEQ_SEG_AMPLITUDE"
+#define waveSeqSegOffsetString      "WAVESEQ_SEG_OFFSET"
+#define waveSeqSegPulseWidthString  "WAVESEQ_SEG_PULSE_WIDTH"
+#define waveSeqSegUserStartString   "WAVESEQ_SEG_USER_START"
+#define waveSeqSegRepeatString      "WAVESEQ_SEG_REPEAT"
+#define waveSeqSegAdvanceString     "WAVESEQ_SEG_ADVANCE"
+#define waveSeqSegNextString        "WAVESEQ_SEG_NEXT"
+#define waveSeqSegJumpBitString     "WAVESEQ_SEG_JUMP_BIT"
+#define waveSeqSegJumpTargetString  "WAVESEQ_SEG_JUMP_TARGET"
+
+// Stimulus-response parameters - global
+#define waveSRRunString             "WAVESR_RUN"
+#define waveSRSyncModeString        "WAVESR_SYNC_MODE"
+#define waveSRStimChanString        "WAVESR_STIM_CHAN"
+#define waveSRMaxLagString          "WAVESR_MAX_LAG"
+#define waveSRStartOffsetString     "WAVESR_START_OFFSET"
+// Stimulus-response parameters - per input
+#define waveSRDelayString           "WAVESR_DELAY"
+#define waveSRGainString            "WAVESR_GAIN"
+#define waveSRCorrelationString     "WAVESR_CORRELATION"
+
+// Logic analyzer parameters
+#define logicPortString             "LOGIC_PORT"
+#define logicNumPointsString        "LOGIC_NUM_POINTS"
+#define logicDwellString            "LOGIC_DWELL"
+#define logicDwellActualString      "LOGIC_DWELL_ACTUAL"
+#define logicExtTriggerString       "LOGIC_EXT_TRIGGER"
+#define logicTriggerModeString      "LOGIC_TRIGGER_MODE"
+#define logicTriggerPatternString   "LOGIC_TRIGGER_PATTERN"
+#define logicTriggerMaskString      "LOGIC_TRIGGER_MASK"
+#define logicRunString              "LOGIC_RUN"
+#define logicCurrentPointString     "LOGIC_CURRENT_POINT"
+#define logicNumTransitionsString   "LOGIC_NUM_TRANSITIONS"
+#define logicTransTimeWFString      "LOGIC_TRANS_TIME_WF"
+#define logicTransValueWFString     "LOGIC_TRANS_VALUE_WF"
+#define logicTransChangedWFString   "LOGIC_TRANS_CHANGED_WF"
+
+// Digital pattern generator parameters
+#define patternGenPortString        "PATTERN_GEN_PORT"
+#define patternGenUserWFString      "PATTERN_GEN_USER_WF"
+#define patternGenNumPointsString   "PATTERN_GEN_NUM_POINTS"
+#define patternGenDwellString       "PATTERN_GEN_DWELL"
+#define patternGenDwellActualString "PATTERN_GEN_DWELL_ACTUAL"
+#define patternGenTotalTimeString   "PATTERN_GEN_TOTAL_TIME"
+#define patternGenTimeWFString      "PATTERN_GEN_TIME_WF"
+#define patternGenExtTriggerString  "PATTERN_GEN_EXT_TRIGGER"
+#define patternGenExtClockString    "PATTERN_GEN_EXT_CLOCK"
+#define patternGenContinuousString  "PATTERN_GEN_CONTINUOUS"
+#define patternGenRunString         "PATTERN_GEN_RUN"
+#define patternGenCurrentPointString "PATTERN_GEN_CURRENT_POINT"
 
 // Trigger parameters
 #define triggerModeString         "TRIGGER_MODE"
@@ -202,16 +414,157 @@ typedef enum {
 #define digitalDirectionString    "DIGITAL_DIRECTION"
 #define digitalInputString        "DIGITAL_INPUT"
 #define digitalOutputString       "DIGITAL_OUTPUT"
+#define digitalOutShadowString    "DIGITAL_OUTPUT_SHADOW"
+#define digitalOutCoalesceMSString "DIGITAL_OUTPUT_COALESCE_MS"
+#define digitalOutFlushesString   "DIGITAL_OUTPUT_FLUSHES"
+#define digitalOutputArrayString  "DIGITAL_OUTPUT_ARRAY"
+#define digitalInputArrayString   "DIGITAL_INPUT_ARRAY"
 
 // MAX_ANALOG_IN and MAX_ANALOG_OUT may need to be changed if additional models are added with larger numbers
 // These are used as a convenience for allocating small arrays of pointers, not large amounts of data
 #define MAX_ANALOG_IN      16
 #define MAX_TEMPERATURE_IN 64
+// Longest median filter of the temperature filter bank
+#define MAX_TEMP_MEDIAN    15
 #define MAX_ANALOG_OUT     16
 #define MAX_IO_PORTS        8
 #define MAX_PULSE_GEN       4
+#define MAX_COUNTERS        4
+#define MAX_WAVESEQ_SEGMENTS 16
 #define MAX_SIGNALS        MAX_TEMPERATURE_IN
 
+// Counter modes for COUNTER_SCAN_ENCODER
+typedef enum {
+  counterModeCount,
+  counterModeEncoderX1,
+  counterModeEncoderX2,
+  counterModeEncoderX4
+} counterMode_t;
+
+// When changes to the settings of a running pulse generator are applied
+typedef enum {
+  pulseCommitImmediate,   // Each write restarts the timer
+  pulseCommitExplicit,    // Writes are staged until PULSE_COMMIT
+  pulseCommitTimed        // Writes are staged for PULSE_COMMIT_DELAY_MS after the first one
+} pulseCommitMode_t;
+
+// Subsystems that the poller reads on their own schedules.  The value is the asyn address
+// of the POLL_PERIOD_MS, POLL_PRIORITY and POLL_ACTUAL_MS parameters for that subsystem.
+typedef enum {
+  pollSubsystemDigitalIn,
+  pollSubsystemCounters,
+  pollSubsystemAnalogOutScan,
+  pollSubsystemAnalogInScan,
+  pollSubsystemAnalogIn,
+  pollSubsystemLogicScan,
+  pollSubsystemCounterScan,
+  pollSubsystemTemperature,
+  pollSubsystemVoltageIn,
+  pollSubsystemPatternGen,
+  NUM_POLL_SUBSYSTEMS
+} pollSubsystem_t;
+
+// Scan events received from the Universal Library and not yet serviced by the poller
+typedef enum {
+  scanEventInputData   = 0x01,
+  scanEventInputEnd    = 0x02,
+  scanEventInputError  = 0x04,
+  scanEventOutputEnd   = 0x08,
+  scanEventOutputError = 0x10
+} scanEventFlag_t;
+#define SCAN_EVENTS_INPUT  (scanEventInputData | scanEventInputEnd | scanEventInputError)
+#define SCAN_EVENTS_OUTPUT (scanEventOutputEnd | scanEventOutputError)
+
+// Settings copied and results staged by the poller, so that the USB transactions can be done
+// without the port lock
+typedef struct {
+  unsigned aoScanSerial;
+  unsigned aiScanSerial;
+  int analogInMode;
+  int analogInRange[MAX_ANALOG_IN];
+  int analogInType[MAX_ANALOG_IN];
+  int analogInRead[MAX_ANALOG_IN];
+  epicsInt32 analogIn[MAX_ANALOG_IN];
+  int analogInBackground;
+  unsigned logicScanSerial;
+  int logicPort;
+  short logicStatus;
+  long logicCount;
+  unsigned counterScanSerial;
+  short counterScanStatus;
+  long counterScanCount;
+  unsigned tempCacheSerial;
+  int tempType[MAX_TEMPERATURE_IN];
+  int tempScale[MAX_TEMPERATURE_IN];
+  int tempFilter[MAX_TEMPERATURE_IN];
+  int tempRead[MAX_TEMPERATURE_IN];
+  double temperature[MAX_TEMPERATURE_IN];
+  epicsUInt64 tempTime;
+  unsigned voltCacheSerial;
+  int voltUsed[MAX_ANALOG_IN];
+  int voltRange[MAX_ANALOG_IN];
+  int voltRead[MAX_ANALOG_IN];
+  double voltage[MAX_ANALOG_IN];
+  epicsUInt64 voltTime;
+  unsigned patternScanSerial;
+  short patternStatus;
+  long patternCount;
+  long patternIndex;
+  short bgStatus;
+  epicsUInt32 bgCount;
+  long bgIndex;
+  epicsUInt32 digitalIn[MAX_IO_PORTS];
+  epicsUInt32 counts[MAX_COUNTERS];
+  epicsUInt64 countTime[MAX_COUNTERS];
+  short aoStatus;
+  long aoCount;
+  long aoIndex;
+  epicsUInt64 aoTotalCount;
+  short aiStatus;
+  long aiCount;
+  long aiIndex;
+  const char *errorMessage;
+  int errorPort;
+  int fatal;
+} pollData_t;
+
+// Maximum number of reads kept for the windowed counter rate
+#define MAX_COUNTER_RATE_SAMPLES 256
+
+// Rate of one counter, computed from the polled counts and the monotonic time of each read
+typedef struct {
+  int valid;                // 0 until the first read after startup or a reset
+  epicsUInt32 prevCounts;
+  epicsUInt64 prevTime;     // epicsMonotonicGet() of the previous read, ns
+  epicsInt64 total;         // Counts extended to 64 bits across 32-bit wraps, signed for encoders
+  double rateEMA;
+  int emaValid;
+  // Ring of (time, total) for the windowed rate
+  epicsUInt64 sampleTime[MAX_COUNTER_RATE_SAMPLES];
+  epicsInt64 sampleTotal[MAX_COUNTER_RATE_SAMPLES];
+  int firstSample;
+  int numSamples;
+} counterRate_t;
+
+// Waveform generator settings copied from the parameter library when a start is requested
+typedef struct {
+  int firstChan;
+  int lastChan;
+  int numPoints;
+  double dwell;
+  int extTrigger;
+  int extClock;
+  int continuous;
+  int retrigger;
+  int scanEvents;
+  int enable[MAX_ANALOG_OUT];
+  int waveType[MAX_ANALOG_OUT];
+  double offset[MAX_ANALOG_OUT];
+  double amplitude[MAX_ANALOG_OUT];
+  double pulseWidth[MAX_ANALOG_OUT];
+  int changed[MAX_ANALOG_OUT];    // Internal waveform was regenerated, needs an array callback
+} waveGenSetup_t;
+
 // For simplicity define a few constants on Linux to be the same as Windows cbw.h
 // These need to be copied from cbw.h because uldaq.h and cbw.h cannot both be included due to some conflicting definitions
 #ifdef linux
@@ -569,6 +922,7 @@ static int maxBoardFamilies = (int) (sizeof(allBoardEnums) / sizeof(boardEnums_t
 #define ROUND(x) ((x) >= 0. ? (int)x+0.5 : (int)(x-0.5))
 #define MAX_BOARDNAME_LEN 256
 #define MAX_LIBRARY_MESSAGE_LEN 256
+#define MAX_FILENAME_LEN 256
 #define PI 3.14159265
 
 /** This is the class definition for the MultiFunction class
@@ -585,11 +939,26 @@ public:
   virtual asynStatus writeUInt32Digital(asynUser *pasynUser, epicsUInt32 value, epicsUInt32 mask);
   virtual asynStatus readFloat32Array(asynUser *pasynUser, epicsFloat32 *value, size_t nElements, size_t *nIn);
   virtual asynStatus writeFloat32Array(asynUser *pasynUser, epicsFloat32 *value, size_t nElements);
+  virtual asynStatus writeInt32Array(asynUser *pasynUser, epicsInt32 *value, size_t nElements);
   virtual asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn);
   virtual asynStatus readEnum(asynUser *pasynUser, char *strings[], int values[], int severities[], size_t nElements, size_t *nIn);
   virtual void report(FILE *fp, int details);
+  // These record which addresses had parameters set, so the poller only calls back those
+  using asynPortDriver::setIntegerParam;
+  using asynPortDriver::setDoubleParam;
+  using asynPortDriver::setUIntDigitalParam;
+  using asynPortDriver::setStringParam;
+  virtual asynStatus setIntegerParam(int list, int index, int value);
+  virtual asynStatus setDoubleParam(int list, int index, double value);
+  virtual asynStatus setUIntDigitalParam(int list, int index, epicsUInt32 value, epicsUInt32 valueMask);
+  virtual asynStatus setStringParam(int list, int index, const char *value);
   // These should be private but are called from C
   virtual void pollerThread(void);
+  virtual void waveFileThread(void);
+  virtual void waveGenThread(void);
+  int queueWaveFileLoad(int channel, const char *fileName, int format);
+  int benchmark(double seconds, epicsUInt64 *pNumCalls);
+  void scanEvent(unsigned eventType, unsigned long long eventData);
 
 protected:
   // Model parameters
@@ -601,6 +970,23 @@ protected:
   int driverVersion_;
   int pollSleepMS_;
   int pollTimeMS_;
+  int pollPeriodMS_;
+  int pollPriority_;
+  int pollActualMS_;
+  int pollCallbacksSkipped_;
+  int pollOverrunPolicy_;
+  int pollJitterMeanMS_;
+  int pollJitterP99MS_;
+  int pollJitterMaxMS_;
+  int pollOverruns_;
+  int scanEvents_;
+  int scanEventCount_;
+  int latencyHistWF_;
+  int latencyBinsWF_;
+  int latencyMeanUs_;
+  int latencyMaxUs_;
+  int latencyCount_;
+  int latencyReset_;
   int lastErrorMessage_;
 
   // Pulse generator parameters
@@ -610,10 +996,42 @@ protected:
   int pulseGenDelay_;
   int pulseGenCount_;
   int pulseGenIdleState_;
+  int pulseGenCommitMode_;
+  int pulseGenCommit_;
+  int pulseGenCommitDelayMS_;
+  int pulseGenPending_;
+  int pulseGenCommitLatencyMS_;
 
   // Counter parameters
   int counterCounts_;
   int counterReset_;
+  int counterTotal_;
+  int counterRate_;
+  int counterRateEMA_;
+  int counterRateWindowed_;
+  int counterRateTau_;
+  int counterRateWindow_;
+
+  // Counter scan parameters
+  int counterScanNumPoints_;
+  int counterScanDwell_;
+  int counterScanDwellActual_;
+  int counterScanExtTrigger_;
+  int counterScanRun_;
+  int counterScanCurrentPoint_;
+  int counterScanTimeWF_;
+  int counterScanCountsWF_;
+  int counterScanRateWF_;
+  int counterScanEncoder_;
+  int counterScanEncoderScale_;
+  int counterScanDiffWidth_;
+  int counterScanSmoothTau_;
+  int counterScanPositionWF_;
+  int counterScanVelocityWF_;
+  int counterScanAccelWF_;
+  int counterScanPosition_;
+  int counterScanVelocity_;
+  int counterScanAccel_;
 
   // Analog input parameters
   int analogInValue_;
@@ -621,10 +1039,14 @@ protected:
   int analogInType_;
   int analogInMode_;
   int analogInRate_;
+  int analogInBackground_;
+  int analogInBgRate_;
+  int analogInAverage_;
 
   // Voltage input parameters
   int voltageInValue_;
   int voltageInRange_;
+  int voltageInCacheMaxAge_;
 
   // Temperature parameters
   int temperatureInValue_;
@@ -634,6 +1056,11 @@ protected:
   int temperatureFilter_;
   int temperatureSensor_;
   int temperatureWiring_;
+  int temperatureCacheMaxAge_;
+  int temperatureLPTau_;
+  int temperatureMedianN_;
+  int temperatureRateLimit_;
+  int temperatureFiltered_;
 
   // Waveform digitizer parameters - global
   int waveDigDwell_;
@@ -654,6 +1081,7 @@ protected:
   int waveDigTimeWF_;
   int waveDigAbsTimeWF_;
   int waveDigReadWF_;
+  int waveDigEventPoints_;
   // Waveform digitizer parameters - per input
   int waveDigVoltWF_;
 
@@ -678,6 +1106,7 @@ protected:
   int waveGenRetrigger_;
   int waveGenTriggerCount_;
   int waveGenRun_;
+  int waveGenState_;
   int waveGenUserTimeWF_;
   int waveGenIntTimeWF_;
   // Waveform generator parameters - per output
@@ -688,6 +1117,78 @@ protected:
   int waveGenPulseWidth_;
   int waveGenIntWF_;
   int waveGenUserWF_;
+  int waveGenUserFile_;
+  int waveGenUserFileFormat_;
+  int waveGenUserFileLoad_;
+  int waveGenUserFileProgress_;
+  int waveGenUserFileChecksum_;
+  int waveGenUserFileStatus_;
+
+  // Waveform sequencer parameters - global
+  int waveSeqRun_;
+  int waveSeqDwell_;
+  int waveSeqDwellActual_;
+  int waveSeqFirstSegment_;
+  int waveSeqRingPoints_;
+  int waveSeqTrigger_;
+  int waveSeqTriggerBit_;
+  int waveSeqCurrentSegment_;
+  int waveSeqCurrentRepeat_;
+  int waveSeqSegmentPoint_;
+  int waveSeqUnderruns_;
+  // Waveform sequencer parameters - per segment
+  int waveSeqSegType_;
+  int waveSeqSegNumPoints_;
+  int waveSeqSegAmplitude_;
+  int waveSeqSegOffset_;
+  int waveSeqSegPulseWidth_;
+  int waveSeqSegUserStart_;
+  int waveSeqSegRepeat_;
+  int waveSeqSegAdvance_;
+  int waveSeqSegNext_;
+  int waveSeqSegJumpBit_;
+  int waveSeqSegJumpTarget_;
+
+  // Stimulus-response parameters - global
+  int waveSRRun_;
+  int waveSRSyncMode_;
+  int waveSRStimChan_;
+  int waveSRMaxLag_;
+  int waveSRStartOffset_;
+  // Stimulus-response parameters - per input
+  int waveSRDelay_;
+  int waveSRGain_;
+  int waveSRCorrelation_;
+
+  // Logic analyzer parameters
+  int logicPort_;
+  int logicNumPoints_;
+  int logicDwell_;
+  int logicDwellActual_;
+  int logicExtTrigger_;
+  int logicTriggerMode_;
+  int logicTriggerPattern_;
+  int logicTriggerMask_;
+  int logicRun_;
+  int logicCurrentPoint_;
+  int logicNumTransitions_;
+  int logicTransTimeWF_;
+  int logicTransValueWF_;
+  int logicTransChangedWF_;
+
+  // Digital pattern generator parameters
+  int patternGenPort_;
+  int patternGenUserWF_;
+  int patternGenNumPoints_;
+  int patternGenDwell_;
+  int patternGenDwellActual_;
+  int patternGenTotalTime_;
+  int patternGenTimeWF_;
+  int patternGenExtTrigger_;
+  int patternGenExtClock_;
+  int patternGenContinuous_;
+  int patternGenRun_;
+  int patternGenCurrentPoint_;
 
   // Trigger parameters
   int triggerMode_;
@@ -696,6 +1197,11 @@ protected:
   int digitalDirection_;
   int digitalInput_;
   int digitalOutput_;
+  int digitalOutShadow_;
+  int digitalOutCoalesceMS_;
+  int digitalOutFlushes_;
+  int digitalOutputArray_;
+  int digitalInputArray_;
 
 private:
   #ifdef _WIN32
@@ -739,12 +1245,16 @@ private:
   double maxPulseGenDelay_;
   double pollTime_;
   int forceCallback_[MAX_IO_PORTS];
+  epicsUInt32 prevDigitalInput_[MAX_IO_PORTS];
+  int paramDirty_[MAX_SIGNALS];
+  epicsUInt64 callbacksSkipped_;
   size_t maxInputPoints_;
   size_t maxOutputPoints_;
   epicsFloat64 *waveDigBuffer_[MAX_ANALOG_IN];
   epicsFloat32 *waveDigTimeBuffer_;
   epicsFloat64 *waveDigAbsTimeBuffer_;
   epicsFloat32 *waveGenIntBuffer_[MAX_ANALOG_OUT];
+  waveGenCache_t waveGenCache_[MAX_ANALOG_OUT];
   epicsFloat32 *waveGenUserBuffer_[MAX_ANALOG_OUT];
   epicsFloat32 *waveGenUserTimeBuffer_;
   epicsFloat32 *waveGenIntTimeBuffer_;
@@ -755,25 +1265,208 @@ private:
     epicsFloat64 *waveGenOutBuffer_;
   #endif
   int numWaveGenChans_;
+  int waveGenFirstChan_;
   int numWaveDigChans_;
+  epicsEventId waveFileEvent_;
+  int waveFilePending_[MAX_ANALOG_OUT];
+  epicsFloat32 *waveFileBuffer_;
   int pulseGenRunning_[MAX_PULSE_GEN];
+  // Staged changes to a running pulse generator: whether any are pending, when the first was
+  // written and when a timed commit is due
+  int pulseGenStaged_[MAX_PULSE_GEN];
+  epicsTime pulseGenFirstChange_[MAX_PULSE_GEN];
+  epicsTime pulseGenCommitTime_[MAX_PULSE_GEN];
   int waveGenRunning_;
+  int waveGenRunState_;
+  int waveGenCancel_;
+  int waveGenRestart_;
+  epicsEventId waveGenEvent_;
+  // Serializes Universal Library calls to this device, shared with any other driver for the same device
+  epicsMutex *ULMutex_;
+  // Guards the contents of the waveform buffers, which waveGenThread fills without the port lock
+  epicsMutex waveGenBufferMutex_;
   int waveDigRunning_;
+  // Incremented when a scan starts, so the poller can discard the status of a scan that was
+  // stopped and restarted while it was doing USB I/O without the port lock
+  unsigned aoScanSerial_;
+  unsigned aiScanSerial_;
+  // Scan events wake the poller so that scan data and the end of a scan are serviced without
+  // waiting for the next poll.  scanEventFlags_, numScanEvents_ and scanEventError_ are guarded by
+  // scanEventMutex_, which is the only lock taken in the Universal Library callback.
+  epicsEventId scanEvent_;
+  epicsMutex scanEventMutex_;
+  unsigned scanEventFlags_;
+  epicsUInt64 numScanEvents_;
+  int scanEventError_;
+  // Set while the events are enabled for the running scans.  aiScanEvents_ is changed with the port
+  // lock and the device lock held, aoScanEvents_ with only the device lock.
+  int aiScanEvents_;
+  int aoScanEvents_;
+  // Logic analyzer state.  The capture is a finite ulDInScan of one digital port.
+  int logicRunning_;
+  unsigned logicScanSerial_;
+  int logicPortIndex_;
+  double logicDwellUsed_;
+  epicsUInt64 *logicBuffer_;
+  epicsFloat64 *logicTransTime_;
+  epicsInt32 *logicTransValue_;
+  epicsInt32 *logicTransChanged_;
+  // Digital pattern generator state.  The user pattern is kept as written and copied into the
+  // output buffer, masked to the port, when the pattern is started.
+  int patternRunning_;
+  unsigned patternScanSerial_;
+  int patternPortIndex_;
+  int patternNumPointsUsed_;
+  int patternUserPoints_;
+  double patternDwellUsed_;
+  epicsInt32 *patternUser_;
+  epicsUInt64 *patternBuffer_;
+  epicsFloat64 *patternTime_;
+  // Shadow registers of the digital output ports.  Writes update the shadow and set the pending
+  // bits, and each flush writes the whole port with one DOut.  Guarded by the port lock.
+  epicsUInt32 doShadow_[MAX_IO_PORTS];
+  epicsUInt32 doPending_[MAX_IO_PORTS];
+  int doShadowValid_[MAX_IO_PORTS];
+  epicsTime doFlushTime_[MAX_IO_PORTS];
+  int doFlushes_[MAX_IO_PORTS];
+  // Set when the device rejected DInArray or DOutArray.  Guarded by the device lock.
+  int digitalArrayFailed_;
+  counterRate_t counterRateState_[MAX_COUNTERS];
+  // Counter scan state.  The scan is a finite ulCInScan of all the counters; the buffers are
+  // allocated for the largest scan so far.
+  int counterScanRunning_;
+  unsigned counterScanSerial_;
+  double counterScanDwellUsed_;
+  int counterScanAllocPoints_;
+  epicsUInt64 *counterScanBuffer_;
+  epicsFloat64 *counterScanTime_;
+  epicsFloat64 *counterScanCounts_[MAX_COUNTERS];
+  epicsFloat64 *counterScanRate_[MAX_COUNTERS];
+  // Encoder mode of each counter and the position, velocity and acceleration from the scan
+  int counterMode_[MAX_COUNTERS];
+  epicsFloat64 *counterScanPositionBuf_[MAX_COUNTERS];
+  epicsFloat64 *counterScanVelocityBuf_[MAX_COUNTERS];
+  epicsFloat64 *counterScanAccelBuf_[MAX_COUNTERS];
+  // Temperatures read by the poller in one TInArray call per scale.  A cache time of 0 means
+  // the channel has not been read since its settings changed.
+  double tempCache_[MAX_TEMPERATURE_IN];
+  epicsUInt64 tempCacheTime_[MAX_TEMPERATURE_IN];
+  unsigned tempCacheSerial_;
+  // Temperature filter bank.  The settings are copied here when they are written so that the
+  // poller filters all the channels in one pass without parameter library lookups.
+  double tempFiltTau_[MAX_TEMPERATURE_IN];
+  int tempFiltMedianN_[MAX_TEMPERATURE_IN];
+  double tempFiltRateLimit_[MAX_TEMPERATURE_IN];
+  double tempFiltered_[MAX_TEMPERATURE_IN];
+  int tempFiltValid_[MAX_TEMPERATURE_IN];
+  double tempMedianBuf_[MAX_TEMPERATURE_IN][MAX_TEMP_MEDIAN];
+  int tempMedianPos_[MAX_TEMPERATURE_IN];
+  int tempMedianCount_[MAX_TEMPERATURE_IN];
+  // Voltages read by the poller for the channels that records have read.  A cache time of 0
+  // means the channel has not been read since its range changed.
+  int voltUsed_[MAX_ANALOG_IN];
+  double voltCache_[MAX_ANALOG_IN];
+  epicsUInt64 voltCacheTime_[MAX_ANALOG_IN];
+  unsigned voltCacheSerial_;
+  // Latency of the Universal Library calls, recorded without a lock by whichever thread makes the call
+  measCompLatencyHistogram ulLatency_[MEAS_COMP_NUM_OPS];
+  // Background scan of the single-point analog inputs, used instead of one ulAIn call per channel
+  // when ANALOG_IN_BACKGROUND is enabled and the waveform digitizer is idle
+  int aiBgRunning_;
+  int aiBgFailed_;
+  int aiBgNumChans_;
+  int aiBgChan_[MAX_ANALOG_IN];
+  int aiBgNumAverage_;
+  int aiBgRingScans_;
+  size_t aiBgBufferSize_;
+  epicsFloat64 *aiBgBuffer_;
+  epicsUInt32 aiBgLastCount_;
+  // Stimulus-response state
+  int waveSRRunning_;
+  int waveSRSync_;
+  epicsFloat64 *waveSRStimBuffer_;
+  // Waveform sequencer state.  The writer fills the AO ring buffer ahead of the playback position.
+  int waveSeqRunning_;
+  int waveSeqFirstChan_;
+  int waveSeqNumChans_;
+  int waveSeqRingSize_;
+  int waveSeqSegment_;
+  int waveSeqRepeat_;
+  int waveSeqSegPoint_;
+  int waveSeqWriterDone_;
+  int waveSeqTriggerPending_;
+  int waveSeqPrevTriggerBit_;
+  epicsUInt64 waveSeqWritePoint_;
+  epicsUInt64 waveSeqEndPoint_;
+  epicsUInt64 waveSeqPlayedPoint_;
+  epicsUInt64 waveSeqTotalCount_;
+  // FIFO of segment starts between the playback position and the writer.  Every segment has at least
+  // one point so ring size + 2 entries always hold the boundaries in the ring.
+  waveSeqBoundary_t *waveSeqBoundary_;
+  int waveSeqBoundarySize_;
+  int waveSeqBoundaryHead_;
+  int waveSeqBoundaryTail_;
+  waveSeqSegment_t waveSeqSegDef_[MAX_WAVESEQ_SEGMENTS];
+  epicsFloat32 *waveSeqSegBuffer_[MAX_WAVESEQ_SEGMENTS];
+  int waveSeqSegBufferSize_[MAX_WAVESEQ_SEGMENTS];
   int startPulseGenerator(int timerNum);
   int stopPulseGenerator(int timerNum);
-  int startWaveGen();
+  int stagePulseGenerator(int timerNum);
+  int commitPulseGenerator(int timerNum);
+  int getWaveGenSetup(waveGenSetup_t *pSetup);
+  int prepareWaveGen(waveGenSetup_t *pSetup);
+  int armWaveGen(waveGenSetup_t *pSetup, double *pDwell);
+  void publishWaveGen(waveGenSetup_t *pSetup, double dwell);
+  int queueWaveGenStart();
   int stopWaveGen();
   int computeWaveGenTimes();
   int startWaveDig();
   int stopWaveDig();
+  int stopWaveDigScan();
+  int startAnalogInBackground();
+  int stopAnalogInBackground();
+  int startLogic();
+  int startPatternGen();
+  int stopPatternGen();
+  int stopLogic();
+  int analyzeLogic(int numPoints);
+  int writeDigitalShadow(int port, epicsUInt32 value, epicsUInt32 mask);
+  int flushDigitalOutput(int port);
+  int digitalArrayUsable(int numPorts, int forOutput);
+  int writeDigitalArray(const epicsInt32 *value, size_t nElements);
+  void updateCounterRate(int counter, epicsUInt32 counts, epicsUInt64 readTime);
+  int startCounterScan();
+  int stopCounterScan();
+  void publishCounterScan(int numPoints);
+  int setCounterMode(int counter, int mode);
   int readWaveDig();
   int computeWaveDigTimes();
   int defineWaveform(int channel);
+  int updateIntWaveform(int channel, int waveType, int numPoints, double dwell,
+                        double offset, double amplitude, double pulseWidth);
+  int startWaveSR();
+  int stopWaveSR();
+  int finishWaveSR();
+  int analyzeWaveSR();
+  int startWaveSeq();
+  int stopWaveSeq();
+  int fillWaveSeq();
+  int pollWaveSeq(short aoStatus, epicsUInt64 aoCount);
+  double getPollPeriod(int subsystem);
+  int pollSubsystemActive(int subsystem);
+  int pollRead(int subsystem, pollData_t *pPoll);
+  int pollPublish(int subsystem, pollData_t *pPoll);
+  int enableScanEvents(int input, unsigned long long threshold);
+  int disableScanEvents(int input);
+  int loadWaveFile(int channel);
   int setOpenThermocoupleDetect(int addr, int value);
+  int readVoltageIn(int addr, int range, double *value);
+  void filterTemperatures(const pollData_t *pPoll);
   int reportError(int err, const char *functionName, const char *message);
   #ifdef linux
   int mapRange(int Gain, Range *range);
   int mapTriggerType(int cbwTriggerType, TriggerType *triggerType);
+  int mapTempScale(int scale, TempScale *tempScale);
   #endif
 };
 
@@ -783,6 +1476,28 @@ static void pollerThreadC(void * pPvt)
     pMultiFunction->pollerThread();
 }
 
+#ifdef _WIN32
+static void __stdcall scanEventCallbackC(int boardNum, unsigned eventType, unsigned eventData, void *pPvt)
+#else
+static void scanEventCallbackC(DaqDeviceHandle handle, DaqEventType eventType, unsigned long long eventData, void *pPvt)
+#endif
+{
+    MultiFunction *pMultiFunction = (MultiFunction *)pPvt;
+    pMultiFunction->scanEvent((unsigned)eventType, eventData);
+}
+
+static void waveFileThreadC(void * pPvt)
+{
+    MultiFunction *pMultiFunction = (MultiFunction *)pPvt;
+    pMultiFunction->waveFileThread();
+}
+
+static void waveGenThreadC(void * pPvt)
+{
+    MultiFunction *pMultiFunction = (MultiFunction *)pPvt;
+    pMultiFunction->waveGenThread();
+}
+
 MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int maxInputPoints, int maxOutputPoints)
   : asynPortDriver(portName, MAX_SIGNALS,
       asynUInt32DigitalMask | asynInt32Mask   | asynInt32ArrayMask   | asynFloat32ArrayMask | 
@@ -796,21 +1511,91 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
     numWaveGenChans_(1),
     numWaveDigChans_(1),
     waveGenRunning_(0),
-    waveDigRunning_(0)
+    waveGenRunState_(waveGenStateIdle),
+    waveGenCancel_(0),
+    waveGenRestart_(0),
+    waveDigRunning_(0),
+    aoScanSerial_(0),
+    aiScanSerial_(0),
+    scanEventFlags_(0),
+    numScanEvents_(0),
+    scanEventError_(0),
+    aiScanEvents_(0),
+    aoScanEvents_(0),
+    logicRunning_(0),
+    logicScanSerial_(0),
+    logicPortIndex_(-1),
+    logicDwellUsed_(0.),
+    patternRunning_(0),
+    patternScanSerial_(0),
+    patternPortIndex_(0),
+    patternNumPointsUsed_(0),
+    patternUserPoints_(0),
+    patternDwellUsed_(0.),
+    digitalArrayFailed_(0),
+    counterScanRunning_(0),
+    counterScanSerial_(0),
+    counterScanDwellUsed_(0.),
+    counterScanAllocPoints_(0),
+    counterScanBuffer_(0),
+    counterScanTime_(0),
+    tempCacheSerial_(0),
+    voltCacheSerial_(0),
+    aiBgRunning_(0),
+    aiBgFailed_(0),
+    aiBgNumChans_(0),
+    aiBgNumAverage_(0),
+    aiBgRingScans_(0),
+    aiBgBufferSize_(0),
+    aiBgBuffer_(0),
+    waveSRRunning_(0),
+    waveSRStimBuffer_(0),
+    waveSeqRunning_(0)
 {
   int i, j;
   int status;
   long long handle;
   static const char *functionName = "MultiFunction";
 
-  for (i=0; i<MAX_PULSE_GEN; i++) pulseGenRunning_[i]=0;
-  for (i=0; i<MAX_IO_PORTS; i++) forceCallback_[i] = 1;
+  for (i=0; i<MAX_PULSE_GEN; i++) {
+    pulseGenRunning_[i]=0;
+    pulseGenStaged_[i]=0;
+  }
+  for (i=0; i<MAX_COUNTERS; i++) {
+    counterRateState_[i].valid = 0;
+    counterRateState_[i].emaValid = 0;
+    counterScanCounts_[i] = 0;
+    counterScanRate_[i] = 0;
+    counterMode_[i] = counterModeCount;
+    counterScanPositionBuf_[i] = 0;
+    counterScanVelocityBuf_[i] = 0;
+    counterScanAccelBuf_[i] = 0;
+  }
+  for (i=0; i<MAX_WAVESEQ_SEGMENTS; i++) {
+    waveSeqSegBuffer_[i] = 0;
+    waveSeqSegBufferSize_[i] = 0;
+  }
+  waveSeqBoundary_ = 0;
+  waveSeqBoundarySize_ = 0;
+  for (i=0; i<MAX_IO_PORTS; i++) {
+    forceCallback_[i] = 1;
+    prevDigitalInput_[i] = 0;
+    doShadow_[i] = 0;
+    doPending_[i] = 0;
+    doShadowValid_[i] = 0;
+    doFlushes_[i] = 0;
+  }
+  for (i=0; i<MAX_SIGNALS; i++) paramDirty_[i] = 0;
+  callbacksSkipped_ = 0;
 
+  // Until the device exists its calls are serialized with the library-wide ones
+  ULMutex_ = measCompGlobalLock();
   status = measCompCreateDevice(uniqueID, daqDeviceDescriptor_, &handle);
   if (status) {
     printf("Error creating device with measCompCreateDevice\n");
     return;
   }
+  ULMutex_ = measCompDeviceLock(handle);
   #ifdef _WIN32
     boardNum_ = (int) handle;
     strcpy(boardName_, daqDeviceDescriptor_.ProductName);
@@ -830,6 +1615,23 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   createParam(driverVersionString,              asynParamOctet, &driverVersion_);
   createParam(pollSleepMSString,              asynParamFloat64, &pollSleepMS_);
   createParam(pollTimeMSString,               asynParamFloat64, &pollTimeMS_);
+  createParam(pollPeriodMSString,             asynParamFloat64, &pollPeriodMS_);
+  createParam(pollPriorityString,             asynParamInt32,   &pollPriority_);
+  createParam(pollActualMSString,             asynParamFloat64, &pollActualMS_);
+  createParam(pollCallbacksSkippedString,     asynParamInt32,   &pollCallbacksSkipped_);
+  createParam(pollOverrunPolicyString,        asynParamInt32,   &pollOverrunPolicy_);
+  createParam(pollJitterMeanMSString,         asynParamFloat64, &pollJitterMeanMS_);
+  createParam(pollJitterP99MSString,          asynParamFloat64, &pollJitterP99MS_);
+  createParam(pollJitterMaxMSString,          asynParamFloat64, &pollJitterMaxMS_);
+  createParam(pollOverrunsString,             asynParamInt32,   &pollOverruns_);
+  createParam(scanEventsString,               asynParamInt32,   &scanEvents_);
+  createParam(scanEventCountString,           asynParamInt32,   &scanEventCount_);
+  createParam(latencyHistWFString,       asynParamInt32Array,   &latencyHistWF_);
+  createParam(latencyBinsWFString,     asynParamFloat64Array,   &latencyBinsWF_);
+  createParam(latencyMeanUsString,            asynParamFloat64, &latencyMeanUs_);
+  createParam(latencyMaxUsString,             asynParamFloat64, &latencyMaxUs_);
+  createParam(latencyCountString,             asynParamInt32,   &latencyCount_);
+  createParam(latencyResetString,             asynParamInt32,   &latencyReset_);
   createParam(lastErrorMessageString,           asynParamOctet, &lastErrorMessage_);
 
   // Pulse generator parameters
@@ -839,10 +1641,42 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   createParam(pulseGenDelayString,           asynParamFloat64, &pulseGenDelay_);
   createParam(pulseGenCountString,             asynParamInt32, &pulseGenCount_);
   createParam(pulseGenIdleStateString,         asynParamInt32, &pulseGenIdleState_);
+  createParam(pulseGenCommitModeString,        asynParamInt32, &pulseGenCommitMode_);
+  createParam(pulseGenCommitString,            asynParamInt32, &pulseGenCommit_);
+  createParam(pulseGenCommitDelayMSString,   asynParamFloat64, &pulseGenCommitDelayMS_);
+  createParam(pulseGenPendingString,           asynParamInt32, &pulseGenPending_);
+  createParam(pulseGenCommitLatencyMSString, asynParamFloat64, &pulseGenCommitLatencyMS_);
 
   // Counter parameters
   createParam(counterCountsString,             asynParamInt32, &counterCounts_);
   createParam(counterResetString,              asynParamInt32, &counterReset_);
+  createParam(counterTotalString,            asynParamFloat64, &counterTotal_);
+  createParam(counterRateString,             asynParamFloat64, &counterRate_);
+  createParam(counterRateEMAString,          asynParamFloat64, &counterRateEMA_);
+  createParam(counterRateWindowedString,     asynParamFloat64, &counterRateWindowed_);
+  createParam(counterRateTauString,          asynParamFloat64, &counterRateTau_);
+  createParam(counterRateWindowString,       asynParamFloat64, &counterRateWindow_);
+
+  // Counter scan parameters
+  createParam(counterScanNumPointsString,       asynParamInt32, &counterScanNumPoints_);
+  createParam(counterScanDwellString,         asynParamFloat64, &counterScanDwell_);
+  createParam(counterScanDwellActualString,   asynParamFloat64, &counterScanDwellActual_);
+  createParam(counterScanExtTriggerString,      asynParamInt32, &counterScanExtTrigger_);
+  createParam(counterScanRunString,             asynParamInt32, &counterScanRun_);
+  createParam(counterScanCurrentPointString,    asynParamInt32, &counterScanCurrentPoint_);
+  createParam(counterScanTimeWFString,   asynParamFloat64Array, &counterScanTimeWF_);
+  createParam(counterScanCountsWFString, asynParamFloat64Array, &counterScanCountsWF_);
+  createParam(counterScanRateWFString,   asynParamFloat64Array, &counterScanRateWF_);
+  createParam(counterScanEncoderString,         asynParamInt32, &counterScanEncoder_);
+  createParam(counterScanEncoderScaleString,  asynParamFloat64, &counterScanEncoderScale_);
+  createParam(counterScanDiffWidthString,       asynParamInt32, &counterScanDiffWidth_);
+  createParam(counterScanSmoothTauString,     asynParamFloat64, &counterScanSmoothTau_);
+  createParam(counterScanPositionWFString, asynParamFloat64Array, &counterScanPositionWF_);
+  createParam(counterScanVelocityWFString, asynParamFloat64Array, &counterScanVelocityWF_);
+  createParam(counterScanAccelWFString,  asynParamFloat64Array, &counterScanAccelWF_);
+  createParam(counterScanPositionString,      asynParamFloat64, &counterScanPosition_);
+  createParam(counterScanVelocityString,      asynParamFloat64, &counterScanVelocity_);
+  createParam(counterScanAccelString,         asynParamFloat64, &counterScanAccel_);
 
   // Analog input parameters
   createParam(analogInValueString,             asynParamInt32, &analogInValue_);
@@ -850,10 +1684,14 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   createParam(analogInTypeString,              asynParamInt32, &analogInType_);
   createParam(analogInModeString,              asynParamInt32, &analogInMode_);
   createParam(analogInRateString,              asynParamInt32, &analogInRate_);
+  createParam(analogInBackgroundString,        asynParamInt32, &analogInBackground_);
+  createParam(analogInBgRateString,          asynParamFloat64, &analogInBgRate_);
+  createParam(analogInAverageString,           asynParamInt32, &analogInAverage_);
 
   // Voltage input parameters
   createParam(voltageInValueString,          asynParamFloat64, &voltageInValue_);
   createParam(voltageInRangeString,            asynParamInt32, &voltageInRange_);
+  createParam(voltageInCacheMaxAgeString,    asynParamFloat64, &voltageInCacheMaxAge_);
 
   // Temperature parameters
   createParam(temperatureInValueString,      asynParamFloat64, &temperatureInValue_);
@@ -863,6 +1701,11 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   createParam(temperatureFilterString,         asynParamInt32, &temperatureFilter_);
   createParam(temperatureSensorString,         asynParamInt32, &temperatureSensor_);
   createParam(temperatureWiringString,         asynParamInt32, &temperatureWiring_);
+  createParam(temperatureCacheMaxAgeString,  asynParamFloat64, &temperatureCacheMaxAge_);
+  createParam(temperatureLPTauString,        asynParamFloat64, &temperatureLPTau_);
+  createParam(temperatureMedianNString,        asynParamInt32, &temperatureMedianN_);
+  createParam(temperatureRateLimitString,    asynParamFloat64, &temperatureRateLimit_);
+  createParam(temperatureFilteredString,     asynParamFloat64, &temperatureFiltered_);
 
   // Waveform digitizer parameters - global
   createParam(waveDigDwellString,            asynParamFloat64, &waveDigDwell_);
@@ -883,6 +1726,7 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   createParam(waveDigTimeWFString,      asynParamFloat32Array, &waveDigTimeWF_);
   createParam(waveDigAbsTimeWFString,   asynParamFloat64Array, &waveDigAbsTimeWF_);
   createParam(waveDigReadWFString,             asynParamInt32, &waveDigReadWF_);
+  createParam(waveDigEventPointsString,        asynParamInt32, &waveDigEventPoints_);
   // Waveform digitizer parameters - per input
   createParam(waveDigVoltWFString,      asynParamFloat32Array, &waveDigVoltWF_);
 
@@ -907,6 +1751,7 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   createParam(waveGenRetriggerString,          asynParamInt32, &waveGenRetrigger_);
   createParam(waveGenTriggerCountString,       asynParamInt32, &waveGenTriggerCount_);
   createParam(waveGenRunString,                asynParamInt32, &waveGenRun_);
+  createParam(waveGenStateString,              asynParamInt32, &waveGenState_);
   createParam(waveGenUserTimeWFString,  asynParamFloat32Array, &waveGenUserTimeWF_);
   createParam(waveGenIntTimeWFString,   asynParamFloat32Array, &waveGenIntTimeWF_);
   // Waveform generator parameters - per output
@@ -917,6 +1762,78 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   createParam(waveGenPulseWidthString,       asynParamFloat64, &waveGenPulseWidth_);
   createParam(waveGenIntWFString,       asynParamFloat32Array, &waveGenIntWF_);
   createParam(waveGenUserWFString,      asynParamFloat32Array, &waveGenUserWF_);
+  createParam(waveGenUserFileString,           asynParamOctet, &waveGenUserFile_);
+  createParam(waveGenUserFileFormatString,     asynParamInt32, &waveGenUserFileFormat_);
+  createParam(waveGenUserFileLoadString,       asynParamInt32, &waveGenUserFileLoad_);
+  createParam(waveGenUserFileProgressString, asynParamFloat64, &waveGenUserFileProgress_);
+  createParam(waveGenUserFileChecksumString,   asynParamInt32, &waveGenUserFileChecksum_);
+  createParam(waveGenUserFileStatusString,     asynParamInt32, &waveGenUserFileStatus_);
+
+  // Waveform sequencer parameters - global
+  createParam(waveSeqRunString,                asynParamInt32, &waveSeqRun_);
+  createParam(waveSeqDwellString,            asynParamFloat64, &waveSeqDwell_);
+  createParam(waveSeqDwellActualString,      asynParamFloat64, &waveSeqDwellActual_);
+  createParam(waveSeqFirstSegmentString,       asynParamInt32, &waveSeqFirstSegment_);
+  createParam(waveSeqRingPointsString,         asynParamInt32, &waveSeqRingPoints_);
+  createParam(waveSeqTriggerString,            asynParamInt32, &waveSeqTrigger_);
+  createParam(waveSeqTriggerBitString,         asynParamInt32, &waveSeqTriggerBit_);
+  createParam(waveSeqCurrentSegmentString,     asynParamInt32, &waveSeqCurrentSegment_);
+  createParam(waveSeqCurrentRepeatString,      asynParamInt32, &waveSeqCurrentRepeat_);
+  createParam(waveSeqSegmentPointString,       asynParamInt32, &waveSeqSegmentPoint_);
+  createParam(waveSeqUnderrunsString,          asynParamInt32, &waveSeqUnderruns_);
+  // Waveform sequencer parameters - per segment
+  createParam(waveSeqSegTypeString,            asynParamInt32, &waveSeqSegType_);
+  createParam(waveSeqSegNumPointsString,       asynParamInt32, &waveSeqSegNumPoints_);
+  createParam(waveSeqSegAmplitudeString,     asynParamFloat64, &waveSeqSegAmplitude_);
+  createParam(waveSeqSegOffsetString,        asynParamFloat64, &waveSeqSegOffset_);
+  createParam(waveSeqSegPulseWidthString,    asynParamFloat64, &waveSeqSegPulseWidth_);
+  createParam(waveSeqSegUserStartString,       asynParamInt32, &waveSeqSegUserStart_);
+  createParam(waveSeqSegRepeatString,          asynParamInt32, &waveSeqSegRepeat_);
+  createParam(waveSeqSegAdvanceString,         asynParamInt32, &waveSeqSegAdvance_);
+  createParam(waveSeqSegNextString,            asynParamInt32, &waveSeqSegNext_);
+  createParam(waveSeqSegJumpBitString,         asynParamInt32, &waveSeqSegJumpBit_);
+  createParam(waveSeqSegJumpTargetString,      asynParamInt32, &waveSeqSegJumpTarget_);
+
+  // Stimulus-response parameters - global
+  createParam(waveSRRunString,                 asynParamInt32, &waveSRRun_);
+  createParam(waveSRSyncModeString,            asynParamInt32, &waveSRSyncMode_);
+  createParam(waveSRStimChanString,            asynParamInt32, &waveSRStimChan_);
+  createParam(waveSRMaxLagString,              asynParamInt32, &waveSRMaxLag_);
+  createParam(waveSRStartOffsetString,       asynParamFloat64, &waveSRStartOffset_);
+  // Stimulus-response parameters - per input
+  createParam(waveSRDelayString,             asynParamFloat64, &waveSRDelay_);
+  createParam(waveSRGainString,              asynParamFloat64, &waveSRGain_);
+  createParam(waveSRCorrelationString,       asynParamFloat64, &waveSRCorrelation_);
+
+  // Logic analyzer parameters
+  createParam(logicPortString,                 asynParamInt32, &logicPort_);
+  createParam(logicNumPointsString,            asynParamInt32, &logicNumPoints_);
+  createParam(logicDwellString,              asynParamFloat64, &logicDwell_);
+  createParam(logicDwellActualString,        asynParamFloat64, &logicDwellActual_);
+  createParam(logicExtTriggerString,           asynParamInt32, &logicExtTrigger_);
+  createParam(logicTriggerModeString,          asynParamInt32, &logicTriggerMode_);
+  createParam(logicTriggerPatternString,       asynParamInt32, &logicTriggerPattern_);
+  createParam(logicTriggerMaskString,          asynParamInt32, &logicTriggerMask_);
+  createParam(logicRunString,                  asynParamInt32, &logicRun_);
+  createParam(logicCurrentPointString,         asynParamInt32, &logicCurrentPoint_);
+  createParam(logicNumTransitionsString,       asynParamInt32, &logicNumTransitions_);
+  createParam(logicTransTimeWFString,   asynParamFloat64Array, &logicTransTimeWF_);
+  createParam(logicTransValueWFString,    asynParamInt32Array, &logicTransValueWF_);
+  createParam(logicTransChangedWFString,  asynParamInt32Array, &logicTransChangedWF_);
+
+  // Digital pattern generator parameters
+  createParam(patternGenPortString,            asynParamInt32, &patternGenPort_);
+  createParam(patternGenUserWFString,     asynParamInt32Array, &patternGenUserWF_);
+  createParam(patternGenNumPointsString,       asynParamInt32, &patternGenNumPoints_);
+  createParam(patternGenDwellString,         asynParamFloat64, &patternGenDwell_);
+  createParam(patternGenDwellActualString,   asynParamFloat64, &patternGenDwellActual_);
+  createParam(patternGenTotalTimeString,     asynParamFloat64, &patternGenTotalTime_);
+  createParam(patternGenTimeWFString,   asynParamFloat64Array, &patternGenTimeWF_);
+  createParam(patternGenExtTriggerString,      asynParamInt32, &patternGenExtTrigger_);
+  createParam(patternGenExtClockString,        asynParamInt32, &patternGenExtClock_);
+  createParam(patternGenContinuousString,      asynParamInt32, &patternGenContinuous_);
+  createParam(patternGenRunString,             asynParamInt32, &patternGenRun_);
+  createParam(patternGenCurrentPointString,    asynParamInt32, &patternGenCurrentPoint_);
 
   // Trigger parameters
   createParam(triggerModeString,               asynParamInt32, &triggerMode_);
@@ -925,6 +1842,11 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   createParam(digitalDirectionString,  asynParamUInt32Digital, &digitalDirection_);
   createParam(digitalInputString,      asynParamUInt32Digital, &digitalInput_);
   createParam(digitalOutputString,     asynParamUInt32Digital, &digitalOutput_);
+  createParam(digitalOutShadowString,          asynParamInt32, &digitalOutShadow_);
+  createParam(digitalOutCoalesceMSString,    asynParamFloat64, &digitalOutCoalesceMS_);
+  createParam(digitalOutFlushesString,         asynParamInt32, &digitalOutFlushes_);
+  createParam(digitalOutputArrayString,   asynParamInt32Array, &digitalOutputArray_);
+  createParam(digitalInputArrayString,    asynParamInt32Array, &digitalInputArray_);
 
   // Map very similar boards for simplicity
   boardFamily_ = boardType_;
@@ -966,7 +1888,7 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   char uniqueIDStr[256];
   char firmwareVersion[256];
   char ULVersion[256];
-  ULMutex.lock();
+  ULMutex_->lock();
   #ifdef _WIN32
     int size = sizeof(uniqueIDStr);
     cbGetConfigString(BOARDINFO, boardNum_, 0, BIDEVUNIQUEID, uniqueIDStr, &size);
@@ -1044,7 +1966,7 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
       digitalIOMask_[i] |= (1 << j);
     }
   }
-  ULMutex.unlock();
+  ULMutex_->unlock();
   // Assume only voltage input is supported
   analogInTypeConfigurable_ = 0;
   // Assume analog in data rate not configurable
@@ -1205,12 +2127,22 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   for (i=0; i<numAnalogOut_; i++) {
     waveGenIntBuffer_[i]  = (epicsFloat32 *) calloc(maxOutputPoints_, sizeof(epicsFloat32));
     waveGenUserBuffer_[i] = (epicsFloat32 *) calloc(maxOutputPoints_, sizeof(epicsFloat32));
+    waveGenCache_[i].valid = 0;
+    waveFilePending_[i] = 0;
   }
+  waveFileBuffer_        = (epicsFloat32 *) calloc(maxOutputPoints_, sizeof(epicsFloat32));
   waveGenUserTimeBuffer_ = (epicsFloat32 *) calloc(maxOutputPoints_, sizeof(epicsFloat32));
   waveGenIntTimeBuffer_  = (epicsFloat32 *) calloc(maxOutputPoints_, sizeof(epicsFloat32));
   waveDigTimeBuffer_     = (epicsFloat32 *) calloc(maxInputPoints_,  sizeof(epicsFloat32));
   waveDigAbsTimeBuffer_  = (epicsFloat64 *) calloc(maxInputPoints_,  sizeof(epicsFloat64));
   pInBuffer_ = (epicsFloat64 *) calloc(maxInputPoints  * numAnalogIn_, sizeof(epicsFloat64));
+  logicBuffer_       = (epicsUInt64 *)  calloc(maxInputPoints_, sizeof(epicsUInt64));
+  logicTransTime_    = (epicsFloat64 *) calloc(maxInputPoints_, sizeof(epicsFloat64));
+  logicTransValue_   = (epicsInt32 *)   calloc(maxInputPoints_, sizeof(epicsInt32));
+  logicTransChanged_ = (epicsInt32 *)   calloc(maxInputPoints_, sizeof(epicsInt32));
+  patternUser_       = (epicsInt32 *)   calloc(maxOutputPoints_, sizeof(epicsInt32));
+  patternBuffer_     = (epicsUInt64 *)  calloc(maxOutputPoints_, sizeof(epicsUInt64));
+  patternTime_       = (epicsFloat64 *) calloc(maxOutputPoints_, sizeof(epicsFloat64));
   #ifdef _WIN32
     waveGenOutBuffer_ = (epicsUInt16 *) calloc(maxOutputPoints * numAnalogOut_, sizeof(epicsUInt16));
   #else
@@ -1223,29 +2155,125 @@ MultiFunction::MultiFunction(const char *portName, const char *uniqueID, int max
   setIntegerParam(waveGenIntNumPoints_, 1);
   setIntegerParam(waveDigNumPoints_, 1);
   setIntegerParam(pulseGenRun_, 0);
+  for (i=0; i<MAX_PULSE_GEN; i++) {
+    setIntegerParam(i, pulseGenCommitMode_, pulseCommitImmediate);
+    setDoubleParam(i, pulseGenCommitDelayMS_, 0.);
+    setIntegerParam(i, pulseGenPending_, 0);
+    setDoubleParam(i, pulseGenCommitLatencyMS_, 0.);
+  }
   setIntegerParam(waveDigRun_, 0);
   setIntegerParam(waveGenRun_, 0);
+  setIntegerParam(waveGenState_, waveGenStateIdle);
+  setIntegerParam(waveSeqRun_, 0);
+  setIntegerParam(waveSRRun_, 0);
+  setIntegerParam(waveSRMaxLag_, 100);
+  setIntegerParam(analogInBackground_, 0);
+  setDoubleParam(analogInBgRate_, 1000.);
+  setIntegerParam(analogInAverage_, 50);
+  setIntegerParam(logicRun_, 0);
+  setIntegerParam(logicCurrentPoint_, 0);
+  setIntegerParam(logicNumTransitions_, 0);
+  setIntegerParam(patternGenRun_, 0);
+  setIntegerParam(patternGenCurrentPoint_, 0);
+  for (i=0; i<MAX_COUNTERS; i++) {
+    setDoubleParam(i, counterRateTau_, 1.);
+    setDoubleParam(i, counterRateWindow_, 1.);
+  }
+  setIntegerParam(counterScanRun_, 0);
+  setIntegerParam(counterScanCurrentPoint_, 0);
+  setIntegerParam(counterScanDiffWidth_, 2);
+  setDoubleParam(counterScanSmoothTau_, 0.01);
+  for (i=0; i<MAX_COUNTERS; i++) {
+    setIntegerParam(i, counterScanEncoder_, counterModeCount);
+    setDoubleParam(i, counterScanEncoderScale_, 1.);
+  }
+  // Digital outputs go through the shadow register and are written as soon as they change
+  for (i=0; i<MAX_IO_PORTS; i++) {
+    setIntegerParam(i, digitalOutShadow_, 1);
+    setDoubleParam(i, digitalOutCoalesceMS_, 0.);
+    setIntegerParam(i, digitalOutFlushes_, 0);
+  }
+  // By default every subsystem is polled at POLL_SLEEP_MS, digital inputs first
+  for (i=0; i<NUM_POLL_SUBSYSTEMS; i++) {
+    setDoubleParam(i, pollPeriodMS_, 0.);
+    setIntegerParam(i, pollPriority_, NUM_POLL_SUBSYSTEMS - 1 - i);
+    setDoubleParam(i, pollActualMS_, 0.);
+    setIntegerParam(i, pollOverrunPolicy_, measCompTimingCatchUp);
+  }
+  // Scans are serviced on Universal Library events if the device supports them
+  setIntegerParam(scanEvents_, 1);
+  setIntegerParam(scanEventCount_, 0);
+  setIntegerParam(waveDigEventPoints_, 0);
+  setIntegerParam(waveSeqRingPoints_, (int)maxOutputPoints_);
+  setIntegerParam(waveSeqTriggerBit_, -1);
+  setIntegerParam(waveSeqCurrentSegment_, -1);
+  setIntegerParam(waveSeqUnderruns_, 0);
+  for (i=0; i<MAX_WAVESEQ_SEGMENTS; i++) {
+    setIntegerParam(i, waveSeqSegNext_, -1);
+    setIntegerParam(i, waveSeqSegJumpBit_, -1);
+  }
   for (i=0; i<numTempChans_; i++) {
     setIntegerParam(i, thermocoupleType_, TC_TYPE_J);
   }
+  for (i=0; i<MAX_TEMPERATURE_IN; i++) {
+    tempCacheTime_[i] = 0;
+    tempFiltTau_[i] = 0.;
+    tempFiltMedianN_[i] = 1;
+    tempFiltRateLimit_[i] = 0.;
+    tempFiltValid_[i] = 0;
+    tempMedianPos_[i] = 0;
+    tempMedianCount_[i] = 0;
+    setDoubleParam(i, temperatureLPTau_, 0.);
+    setIntegerParam(i, temperatureMedianN_, 1);
+    setDoubleParam(i, temperatureRateLimit_, 0.);
+  }
+  setDoubleParam(temperatureCacheMaxAge_, 1.0);
+  for (i=0; i<MAX_ANALOG_IN; i++) {
+    voltUsed_[i] = 0;
+    voltCacheTime_[i] = 0;
+  }
+  setDoubleParam(voltageInCacheMaxAge_, 1.0);
   // Set the analog output range to the first supported value for this model
   for (i=0; i<MAX_ANALOG_OUT; i++) {
     setIntegerParam(i, analogOutRange_, pBoardEnums_->pOutputRange[0].enumValue);
+    setStringParam(i, waveGenUserFile_, "");
+    setIntegerParam(i, waveGenUserFileLoad_, 0);
+    setDoubleParam(i, waveGenUserFileProgress_, 0.);
+    setIntegerParam(i, waveGenUserFileChecksum_, 0);
+    setIntegerParam(i, waveGenUserFileStatus_, waveFileStatusIdle);
   }
 
   /* Start the thread to poll counters and digital inputs and do callbacks to
-   * device support */
+   * device support.  It is also woken by the scan events. */
+  scanEvent_ = epicsEventCreate(epicsEventEmpty);
   epicsThreadCreate("MultiFunctionPoller",
-                    epicsThreadPriorityLow,
+                    measCompThreadPriority("MultiFunctionPoller", epicsThreadPriorityLow),
                     epicsThreadGetStackSize(epicsThreadStackMedium),
                     (EPICSTHREADFUNC)pollerThreadC,
                     this);
+
+  /* Start the thread that loads user waveform files so that large files
+   * do not block the port or the poller */
+  waveFileEvent_ = epicsEventCreate(epicsEventEmpty);
+  epicsThreadCreate("MultiFunctionWaveFile",
+                    measCompThreadPriority("MultiFunctionWaveFile", epicsThreadPriorityLow),
+                    epicsThreadGetStackSize(epicsThreadStackMedium),
+                    (EPICSTHREADFUNC)waveFileThreadC,
+                    this);
+
+  /* Start the thread that prepares and starts the waveform generator */
+  waveGenEvent_ = epicsEventCreate(epicsEventEmpty);
+  epicsThreadCreate("MultiFunctionWaveGen",
+                    measCompThreadPriority("MultiFunctionWaveGen", epicsThreadPriorityMedium),
+                    epicsThreadGetStackSize(epicsThreadStackMedium),
+                    (EPICSTHREADFUNC)waveGenThreadC,
+                    this);
 }
 
 int  MultiFunction::reportError(int err, const char *functionName, const char *message)
 {
   char libraryMessage[MAX_LIBRARY_MESSAGE_LEN];
-  ULMutex.lock();
+  ULMutex_->lock();
   switch (err) {
     case 0: 
       asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
@@ -1264,7 +2292,7 @@ int  MultiFunction::reportError(int err, const char *functionName, const char *m
       asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
         "%s::%s Error: %s, err=%d %s\n", driverName, functionName, message, err, libraryMessage);
   }
-  ULMutex.unlock();
+  ULMutex_->unlock();
   return err;
 }
 
@@ -1324,6 +2352,25 @@ int MultiFunction::mapRange(int Gain, Range *range)
     return 0;
 }
 
+// Converts a cbw temperature scale to a uldaq TempScale
+int MultiFunction::mapTempScale(int scale, TempScale *tempScale)
+{
+    static const char *functionName = "mapTempScale";
+    switch (scale) {
+        case CELSIUS:     *tempScale = TS_CELSIUS; break;
+        case FAHRENHEIT:  *tempScale = TS_FAHRENHEIT; break;
+        case KELVIN:      *tempScale = TS_KELVIN; break;
+        case VOLTS:       *tempScale = TS_VOLTS; break;
+        case NOSCALE:     *tempScale = TS_NOSCALE; break;
+        default:
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s unsupported Scale=%d\n", driverName, functionName, scale);
+            *tempScale = TS_CELSIUS;
+            return -1;
+    }
+    return 0;
+}
+
 // This function maps the trigger types from UL on Windows to the values in UL for Linux.
 // We can't use the macros from Windows cbw.h because they conflict with UL for Linux.
 // These definitions are taken from cbw.h, but added CBW_ prefix.
@@ -1406,19 +2453,22 @@ int MultiFunction::startPulseGenerator(int timerNum)
   if (delay < minPulseGenDelay_) delay = minPulseGenDelay_;
   if (delay > maxPulseGenDelay_) delay = maxPulseGenDelay_;
 
-  ULMutex.lock();
+  ULMutex_->lock();
   #ifdef _WIN32
     status = cbPulseOutStart(boardNum_, timerNum, &frequency, &dutyCycle, count, &delay, idleState, 0);
   #else
     TmrIdleState idle = (idleState == 0) ? TMRIS_LOW : TMRIS_HIGH;
     status = ulTmrPulseOutStart(daqDeviceHandle_, timerNum, &frequency, &dutyCycle, count, &delay, idle, PO_DEFAULT);
   #endif
-  ULMutex.unlock();
+  ULMutex_->unlock();
   reportError(status, functionName, "Calling PulseOutStart");
   if (status) return status;
   // We may not have gotten the frequency, dutyCycle, and delay we asked for, set the actual values
   // in the parameter library
   pulseGenRunning_[timerNum] = 1;
+  // The timer now has all the settings
+  pulseGenStaged_[timerNum] = 0;
+  setIntegerParam(timerNum, pulseGenPending_, 0);
   period = 1. / frequency;
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
     "%s:%s: started pulse generator %d actual frequency=%f, actual period=%f, actual duty cycle=%f, actual delay=%f\n",
@@ -1432,25 +2482,168 @@ int MultiFunction::startPulseGenerator(int timerNum)
 int MultiFunction::stopPulseGenerator(int timerNum)
 {
   pulseGenRunning_[timerNum] = 0;
+  pulseGenStaged_[timerNum] = 0;
+  setIntegerParam(timerNum, pulseGenPending_, 0);
   int err;
-  ULMutex.lock();
+  ULMutex_->lock();
   #ifdef _WIN32
     err = cbPulseOutStop(boardNum_, timerNum);
   #else
     err = ulTmrPulseOutStop(daqDeviceHandle_, timerNum);
   #endif
-  ULMutex.unlock();
+  ULMutex_->unlock();
   return err;
 }
 
+/** Applies a new setting to a running pulse generator according to PULSE_COMMIT_MODE.
+  * In immediate mode the timer is restarted now.  Otherwise the change is staged and the timer
+  * is restarted once with all the staged settings, on PULSE_COMMIT or when PULSE_COMMIT_DELAY_MS
+  * has passed since the first staged change.  Called with the port locked. */
+int MultiFunction::stagePulseGenerator(int timerNum)
+{
+  int mode;
+  double delayMS;
+
+  // A stopped timer gets the settings when it is started
+  if (!pulseGenRunning_[timerNum]) return 0;
+  getIntegerParam(timerNum, pulseGenCommitMode_, &mode);
+  if (!pulseGenStaged_[timerNum]) {
+    pulseGenStaged_[timerNum] = 1;
+    pulseGenFirstChange_[timerNum] = epicsTime::getCurrent();
+    setIntegerParam(timerNum, pulseGenPending_, 1);
+    if (mode == pulseCommitTimed) {
+      // Wake the poller so that it sleeps only until the commit is due
+      getDoubleParam(timerNum, pulseGenCommitDelayMS_, &delayMS);
+      pulseGenCommitTime_[timerNum] = pulseGenFirstChange_[timerNum] + delayMS/1000.;
+      epicsEventSignal(scanEvent_);
+    }
+  }
+  if (mode == pulseCommitImmediate) return commitPulseGenerator(timerNum);
+  return 0;
+}
+
+/** Restarts a running pulse generator with the staged settings.  Called with the port locked. */
+int MultiFunction::commitPulseGenerator(int timerNum)
+{
+  int status;
+  epicsTime firstChange = pulseGenFirstChange_[timerNum];
+
+  if (!pulseGenStaged_[timerNum]) return 0;
+  if (!pulseGenRunning_[timerNum]) {
+    pulseGenStaged_[timerNum] = 0;
+    setIntegerParam(timerNum, pulseGenPending_, 0);
+    return 0;
+  }
+  status = stopPulseGenerator(timerNum);
+  status |= startPulseGenerator(timerNum);
+  setDoubleParam(timerNum, pulseGenCommitLatencyMS_, (epicsTime::getCurrent() - firstChange)*1000.);
+  return status;
+}
+
+// Differentiates numPoints samples spaced by dt.  With width=0 this is the first difference.
+// Otherwise it is the least-squares slope over 2*width+1 points centred on each point, which
+// smooths the noise of the quantized positions; the window shrinks near the ends of the data.
+static void differentiate(const epicsFloat64 *in, epicsFloat64 *out, int numPoints, double dt, int width)
+{
+  int i, k, m;
+  double sum, norm;
+
+  for (i=0; i<numPoints; i++) {
+    m = width;
+    if (m > i) m = i;
+    if (m > numPoints-1-i) m = numPoints-1-i;
+    if (m <= 0) {
+      if (numPoints < 2)  out[i] = 0.;
+      else if (i == 0)    out[i] = (in[1] - in[0]) / dt;
+      else                out[i] = (in[i] - in[i-1]) / dt;
+      continue;
+    }
+    sum = 0.;
+    for (k=1; k<=m; k++) sum += k * (in[i+k] - in[i-k]);
+    norm = m * (m+1) * (2*m+1) / 3.;
+    out[i] = sum / (norm * dt);
+  }
+}
+
+// Fills outPtr with numPoints of one of the pre-defined waveform types
+static void synthesizeWaveform(int waveType, int numPoints, double dwell, double offset,
+                               double amplitude, double pulseWidth, epicsFloat32 *outPtr)
+{
+  int nPulse;
+  int i;
+  double base, scale;
+
+  base = offset - amplitude/2.;
+  switch (waveType) {
+    case waveTypeSin:
+      scale = 2.*PI/(numPoints-1);
+      for (i=0; i<numPoints; i++)           *outPtr++ = (epicsFloat32) (offset + amplitude/2. * sin(i*scale));
+      break;
+    case waveTypeSquare:
+      for (i=0; i<numPoints/2; i++)         *outPtr++ = (epicsFloat32) (base + amplitude);
+      for (i=numPoints/2; i<numPoints; i++) *outPtr++ = (epicsFloat32) (base);
+      break;
+    case waveTypeSawTooth:
+      scale = 1./(numPoints-1);
+      for (i=0; i<numPoints; i++)           *outPtr++ = (epicsFloat32) (base + amplitude*i*scale);
+      break;
+    case waveTypePulse:
+      nPulse = (int) ((pulseWidth / dwell) + 0.5);
+      if (nPulse < 1) nPulse = 1;
+      if (nPulse >= numPoints-1) nPulse = numPoints-1;
+      for (i=0; i<nPulse; i++)              *outPtr++ = (epicsFloat32) (base + amplitude);
+      for (i=nPulse; i<numPoints; i++)      *outPtr++ = (epicsFloat32) (base);
+      break;
+    case waveTypeRandom:
+      scale = amplitude / RAND_MAX;
+      srand(1);
+      for (i=0; i<numPoints; i++)           *outPtr++ = (epicsFloat32) (base + rand() * scale);
+      break;
+  }
+}
+
+// Converts volts to D/A units for the 16-bit, +-10V DAC used by the waveform generator
+static epicsUInt16 voltsToDACCounts(double volts)
+{
+  double counts = (volts + 10.)*65535./20. + 0.5;
+  if (counts < 0.) counts = 0.;
+  if (counts > 65535.) counts = 65535.;
+  return (epicsUInt16) counts;
+}
+
+// Synthesizes an internal waveform into waveGenIntBuffer_[channel] unless the buffer already holds it.
+// Returns 1 if the buffer was rewritten.  Must be called with waveGenBufferMutex_ held.
+int MultiFunction::updateIntWaveform(int channel, int waveType, int numPoints, double dwell,
+                                     double offset, double amplitude, double pulseWidth)
+{
+  waveGenCache_t *pCache = &waveGenCache_[channel];
+
+  if (pCache->valid &&
+      (pCache->waveType   == waveType) &&
+      (pCache->numPoints  == numPoints) &&
+      (pCache->dwell      == dwell) &&
+      (pCache->offset     == offset) &&
+      (pCache->amplitude  == amplitude) &&
+      (pCache->pulseWidth == pulseWidth)) {
+    return 0;
+  }
+
+  synthesizeWaveform(waveType, numPoints, dwell, offset, amplitude, pulseWidth, waveGenIntBuffer_[channel]);
+  pCache->valid      = 1;
+  pCache->waveType   = waveType;
+  pCache->numPoints  = numPoints;
+  pCache->dwell      = dwell;
+  pCache->offset     = offset;
+  pCache->amplitude  = amplitude;
+  pCache->pulseWidth = pulseWidth;
+  return 1;
+}
+
 int MultiFunction::defineWaveform(int channel)
 {
   int waveType;
   int numPoints;
-  int nPulse;
-  int i;
-  epicsFloat32 *outPtr = waveGenIntBuffer_[channel];
-  double dwell, offset, base, amplitude, pulseWidth, scale;
+  double dwell, offset, amplitude, pulseWidth;
   static const char *functionName = "defineWaveform";
 
   getIntegerParam(channel, waveGenWaveType_,  &waveType);
@@ -1484,73 +2677,44 @@ int MultiFunction::defineWaveform(int channel)
   setIntegerParam(waveGenNumPoints_, numPoints);
   setDoubleParam(waveGenDwell_, dwell);
   setDoubleParam(waveGenFreq_, 1./dwell/numPoints);
-  base = offset - amplitude/2.;
-  switch (waveType) {
-    case waveTypeSin:
-      scale = 2.*PI/(numPoints-1);
-      for (i=0; i<numPoints; i++)           *outPtr++ = (epicsFloat32) (offset + amplitude/2. * sin(i*scale));
-      break;
-    case waveTypeSquare:
-      for (i=0; i<numPoints/2; i++)         *outPtr++ = (epicsFloat32) (base + amplitude);
-      for (i=numPoints/2; i<numPoints; i++) *outPtr++ = (epicsFloat32) (base);
-      break;
-    case waveTypeSawTooth:
-      scale = 1./(numPoints-1);
-      for (i=0; i<numPoints; i++)           *outPtr++ = (epicsFloat32) (base + amplitude*i*scale);
-      break;
-    case waveTypePulse:
-      nPulse = (int) ((pulseWidth / dwell) + 0.5);
-      if (nPulse < 1) nPulse = 1;
-      if (nPulse >= numPoints-1) nPulse = numPoints-1;
-      for (i=0; i<nPulse; i++)              *outPtr++ = (epicsFloat32) (base + amplitude);
-      for (i=nPulse; i<numPoints; i++)      *outPtr++ = (epicsFloat32) (base);
-      break;
-    case waveTypeRandom:
-      scale = amplitude / RAND_MAX;
-      srand(1);
-      for (i=0; i<numPoints; i++)           *outPtr++ = (epicsFloat32) (base + rand() * scale);
-      break;
+
+  waveGenBufferMutex_.lock();
+  if (updateIntWaveform(channel, waveType, numPoints, dwell, offset, amplitude, pulseWidth)) {
+    doCallbacksFloat32Array(waveGenIntBuffer_[channel], numPoints, waveGenIntWF_, channel);
   }
-  doCallbacksFloat32Array(waveGenIntBuffer_[channel], numPoints, waveGenIntWF_, channel);
+  waveGenBufferMutex_.unlock();
   return 0;
 }
 
-int MultiFunction::startWaveGen()
+// Copies the waveform generator settings from the parameter library.  Called with the port locked.
+int MultiFunction::getWaveGenSetup(waveGenSetup_t *pSetup)
 {
-  int status=0;
-  int numPoints;
-  int enable;
-  int firstChan=-1, lastChan=-1, firstType=-1;
-  int waveType;
-  int extTrigger, extClock, continuous, retrigger;
-  int options;
-  int i, j, k;
-  double offset, scale;
-  double userOffset, userAmplitude;
-  double dwell;
-  epicsFloat32* inPtr[MAX_ANALOG_OUT];
-  #ifdef _WIN32
-    epicsUInt16 *outPtr;
-  #else
-    epicsFloat64 *outPtr;
-  #endif
-  static const char *functionName = "startWaveGen";
-
-  getIntegerParam(waveGenExtTrigger_, &extTrigger);
-  getIntegerParam(waveGenExtClock_,   &extClock);
-  getIntegerParam(waveGenContinuous_, &continuous);
-  getIntegerParam(waveGenRetrigger_,  &retrigger);
+  int i;
+  int enable, waveType;
+  int firstType=-1;
+  static const char *functionName = "getWaveGenSetup";
+
+  memset(pSetup, 0, sizeof(*pSetup));
+  pSetup->firstChan = -1;
+  pSetup->lastChan = -1;
+  getIntegerParam(waveGenExtTrigger_, &pSetup->extTrigger);
+  getIntegerParam(waveGenExtClock_,   &pSetup->extClock);
+  getIntegerParam(waveGenContinuous_, &pSetup->continuous);
+  getIntegerParam(waveGenRetrigger_,  &pSetup->retrigger);
+  getIntegerParam(scanEvents_,        &pSetup->scanEvents);
+  if (waveSRRunning_) {
+    // Stimulus-response mode selects the trigger and clock so both scans start together
+    pSetup->extTrigger = (waveSRSync_ == waveSRSyncExtTrigger);
+    pSetup->extClock   = (waveSRSync_ == waveSRSyncExtClock);
+    pSetup->retrigger  = 0;
+  }
 
   for (i=0; i<numAnalogOut_; i++) {
     getIntegerParam(i, waveGenEnable_, &enable);
     if (!enable) continue;
     getIntegerParam(i, waveGenWaveType_,  &waveType);
-    if (waveType == waveTypeUser)
-      inPtr[i] = waveGenUserBuffer_[i];
-    else
-      inPtr[i] = waveGenIntBuffer_[i];
-    if (firstChan < 0) {
-      firstChan = i;
+    if (pSetup->firstChan < 0) {
+      pSetup->firstChan = i;
       firstType = waveType;
     }
     // Cannot mix user-defined and internal waveform types, because internal modifies dwell time
@@ -1562,107 +2726,258 @@ int MultiFunction::startWaveGen()
         driverName, functionName);
       return -1;
     }
-    lastChan = i;
-    status = defineWaveform(i);
-    if (status) return -1;
+    pSetup->lastChan = i;
+    pSetup->enable[i] = 1;
+    pSetup->waveType[i] = waveType;
+    getDoubleParam(i, waveGenOffset_,     &pSetup->offset[i]);
+    getDoubleParam(i, waveGenAmplitude_,  &pSetup->amplitude[i]);
+    getDoubleParam(i, waveGenPulseWidth_, &pSetup->pulseWidth[i]);
   }
 
-  if (firstChan < 0) {
+  if (pSetup->firstChan < 0) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
       "%s:%s: ERROR no enabled channels\n",
       driverName, functionName);
      return -1;
   }
 
-  numWaveGenChans_ = lastChan - firstChan + 1;
+  if (firstType == waveTypeUser) {
+    getIntegerParam(waveGenUserNumPoints_, &pSetup->numPoints);
+    getDoubleParam(waveGenUserDwell_, &pSetup->dwell);
+  } else {
+    getIntegerParam(waveGenIntNumPoints_, &pSetup->numPoints);
+    getDoubleParam(waveGenIntDwell_, &pSetup->dwell);
+  }
+  if ((size_t)pSetup->numPoints > maxOutputPoints_) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR numPoints=%d must be less than maxOutputPoints=%d\n",
+      driverName, functionName, pSetup->numPoints, (int)maxOutputPoints_);
+    return -1;
+  }
+  setIntegerParam(waveGenNumPoints_, pSetup->numPoints);
+  setDoubleParam(waveGenDwell_, pSetup->dwell);
+  setDoubleParam(waveGenFreq_, 1./pSetup->dwell/pSetup->numPoints);
+  return 0;
+}
+
+// Synthesizes the internal waveforms and converts all channels to D/A units in waveGenOutBuffer_.
+// This does not use the parameter library and is called without the port lock held.
+int MultiFunction::prepareWaveGen(waveGenSetup_t *pSetup)
+{
+  int i, j, k;
+  int numChans = pSetup->lastChan - pSetup->firstChan + 1;
+  int numPoints = pSetup->numPoints;
+  double userOffset, userAmplitude;
+  epicsFloat32 *inPtr;
+  #ifdef _WIN32
+    epicsUInt16 *outPtr;
+  #else
+    epicsFloat64 *outPtr;
+  #endif
 
-  // dwell and numPoints were computed by defineWaveform above
-  getIntegerParam(waveGenNumPoints_, &numPoints);
-  getDoubleParam(waveGenDwell_, &dwell);
- 
-  // Copy data from float32 array to outputMemHandel, converting from volts to D/A units
-  // Pre-defined waveforms have been fully defined at this point
-  // User-defined waveforms need to have the offset and scale applied
-  for (i=0; i<numWaveGenChans_; i++) {
-    k = firstChan + i;
+  waveGenBufferMutex_.lock();
+  for (i=0; i<numChans; i++) {
+    k = pSetup->firstChan + i;
     outPtr = &(waveGenOutBuffer_[i]);
-    offset = 10.;        // Mid-scale range of DAC
-    scale = 65535./20.;  // D/A units per volt; 16-bit DAC, +-10V range
-    if (waveType == waveTypeUser) {
-      getDoubleParam(i, waveGenOffset_, &userOffset);
-      getDoubleParam(i, waveGenAmplitude_,  &userAmplitude);
+    if (!pSetup->enable[k]) {
+      // Disabled channels between enabled ones are held at 0 volts
+      for (j=0; j<numPoints; j++) {
+        *outPtr = voltsToDACCounts(0.);
+        outPtr += numChans;
+      }
+      continue;
+    }
+    // Pre-defined waveforms are fully defined by synthesis
+    // User-defined waveforms need to have the offset and scale applied
+    if (pSetup->waveType[k] == waveTypeUser) {
+      inPtr = waveGenUserBuffer_[k];
+      userOffset = pSetup->offset[k];
+      userAmplitude = pSetup->amplitude[k];
     } else {
+      pSetup->changed[k] = updateIntWaveform(k, pSetup->waveType[k], numPoints, pSetup->dwell,
+                                             pSetup->offset[k], pSetup->amplitude[k], pSetup->pulseWidth[k]);
+      inPtr = waveGenIntBuffer_[k];
       userOffset = 0.;
       userAmplitude = 1.0;
     }
     for (j=0; j<numPoints; j++) {
-     *outPtr = (epicsUInt16)((inPtr[k][j]*userAmplitude + userOffset + offset)*scale + 0.5);
-      outPtr += numWaveGenChans_;
+      *outPtr = voltsToDACCounts(inPtr[j]*userAmplitude + userOffset);
+      outPtr += numChans;
     }
   }
-  ULMutex.lock();
+  waveGenBufferMutex_.unlock();
+  return 0;
+}
+
+// Starts the AO scan from the prepared waveGenOutBuffer_.  Only the device lock is taken,
+// so this can be called without the port lock.  Returns the actual dwell in *pDwell.
+int MultiFunction::armWaveGen(waveGenSetup_t *pSetup, double *pDwell)
+{
+  int status;
+  int options;
+  int firstChan = pSetup->firstChan;
+  int lastChan = pSetup->lastChan;
+  int numChans = lastChan - firstChan + 1;
+  int numPoints = pSetup->numPoints;
+  double dwell = pSetup->dwell;
+  static const char *functionName = "armWaveGen";
+
+  ULMutex_->lock();
+  // The end of scan event must be enabled before the scan is started
+  if (aoScanEvents_) disableScanEvents(0);
+  aoScanEvents_ = pSetup->scanEvents && (enableScanEvents(0, 0) == 0);
   #ifdef _WIN32
     long pointsPerSecond = (long)((1. / dwell) + 0.5);
-    options                  = BACKGROUND;
-    if (extTrigger) options |= EXTTRIGGER;
-    if (extClock)   options |= EXTCLOCK;
-    if (continuous) options |= CONTINUOUS;
-    if (retrigger)  options |= RETRIGMODE;
-    status = cbAOutScan(boardNum_, firstChan, lastChan, numWaveGenChans_*numPoints, &pointsPerSecond, BIP10VOLTS,
-                        waveGenOutBuffer_, options);
+    options                            = BACKGROUND;
+    if (pSetup->extTrigger) options   |= EXTTRIGGER;
+    if (pSetup->extClock)   options   |= EXTCLOCK;
+    if (pSetup->continuous) options   |= CONTINUOUS;
+    if (pSetup->retrigger)  options   |= RETRIGMODE;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = cbAOutScan(boardNum_, firstChan, lastChan, numChans*numPoints, &pointsPerSecond, BIP10VOLTS,
+                                                                         waveGenOutBuffer_, options));
     // Convert back from pointsPerSecond to dwell, since value might have changed
     dwell = (1. / pointsPerSecond);
   #else
-    options                  = SO_DEFAULTIO;
-    if (extTrigger) options |= SO_EXTTRIGGER;
-    if (extClock)   options |= SO_EXTCLOCK;
-    if (continuous) options |= SO_CONTINUOUS;
-    if (retrigger)  options |= SO_RETRIGGER;
+    options                            = SO_DEFAULTIO;
+    if (pSetup->extTrigger) options   |= SO_EXTTRIGGER;
+    if (pSetup->extClock)   options   |= SO_EXTCLOCK;
+    if (pSetup->continuous) options   |= SO_CONTINUOUS;
+    if (pSetup->retrigger)  options   |= SO_RETRIGGER;
     double rate = 1./dwell;
-    status = ulAOutScan(daqDeviceHandle_, firstChan, lastChan, BIP10VOLTS, numPoints, &rate, (ScanOption) options, AOUTSCAN_FF_NOSCALEDATA, waveGenOutBuffer_);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = ulAOutScan(daqDeviceHandle_, firstChan, lastChan, BIP10VOLTS, numPoints, &rate, (ScanOption) options, AOUTSCAN_FF_NOSCALEDATA, waveGenOutBuffer_));
     // Convert back from rate to dwell, since value might have changed
     dwell = 1./rate;
   #endif
-  ULMutex.unlock();
+  if (status && aoScanEvents_) {
+    disableScanEvents(0);
+    aoScanEvents_ = 0;
+  }
+  ULMutex_->unlock();
   reportError(status, functionName, "Calling AOutScan");
-
   if (status) return status;
 
-  waveGenRunning_ = 1;
-  setIntegerParam(waveGenRun_, 1);
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
     "%s:%s: called cbAOutScan, firstChan=%d, lastChan=%d, numPoints*numWaveGenChans_=%d, dwell=%f, options=0x%x\n",
-    driverName, functionName, firstChan, lastChan,  numWaveGenChans_*numPoints, dwell, options);
+    driverName, functionName, firstChan, lastChan,  numChans*numPoints, dwell, options);
+  *pDwell = dwell;
+  return 0;
+}
+
+// Records that the AO scan has been started.  Called with the port locked.
+void MultiFunction::publishWaveGen(waveGenSetup_t *pSetup, double dwell)
+{
+  int i;
 
+  for (i=pSetup->firstChan; i<=pSetup->lastChan; i++) {
+    if (!pSetup->changed[i]) continue;
+    waveGenBufferMutex_.lock();
+    doCallbacksFloat32Array(waveGenIntBuffer_[i], pSetup->numPoints, waveGenIntWF_, i);
+    waveGenBufferMutex_.unlock();
+  }
+  numWaveGenChans_ = pSetup->lastChan - pSetup->firstChan + 1;
+  waveGenFirstChan_ = pSetup->firstChan;
+  waveGenRunning_ = 1;
+  aoScanSerial_++;
+  // With an external trigger the scan is armed until the poller sees the first point output
+  waveGenRunState_ = pSetup->extTrigger ? waveGenStateArmed : waveGenStateRunning;
+  setIntegerParam(waveGenState_, waveGenRunState_);
+  setIntegerParam(waveGenRun_, 1);
   setDoubleParam(waveGenDwellActual_, dwell);
-  setDoubleParam(waveGenTotalTime_, dwell*numPoints);
-  return status;
+  setDoubleParam(waveGenTotalTime_, dwell*pSetup->numPoints);
 }
 
-int MultiFunction::stopWaveGen()
+// Requests a waveform generator start from waveGenThread.  Called with the port locked.
+int MultiFunction::queueWaveGenStart()
 {
-  int err;
-  waveGenRunning_ = 0;
-  setIntegerParam(waveGenRun_, 0);
-  ULMutex.lock();
-  #ifdef _WIN32
-    err = cbStopBackground(boardNum_, AOFUNCTION);
-  #else
-    err = ulAOutScanStop(daqDeviceHandle_);
-  #endif
-  ULMutex.unlock();
-  return err;
+  if (waveGenRunState_ == waveGenStatePreparing) {
+    // Settings changed after the snapshot was taken, so prepare again once this one is armed
+    waveGenRestart_ = 1;
+    return 0;
+  }
+  waveGenRunState_ = waveGenStatePreparing;
+  waveGenCancel_ = 0;
+  waveGenRestart_ = 0;
+  setIntegerParam(waveGenState_, waveGenRunState_);
+  setIntegerParam(waveGenRun_, 1);
+  epicsEventSignal(waveGenEvent_);
+  return 0;
 }
 
-int MultiFunction::computeWaveGenTimes()
+// Prepares and starts the waveform generator outside of the port lock, so that a long
+// synthesis does not block the other records on the port or the poller.
+void MultiFunction::waveGenThread()
 {
-  int numPoints, i;
+  waveGenSetup_t setup;
+  int status;
+  int cancel;
   double dwell;
 
-  getIntegerParam(waveGenUserNumPoints_, &numPoints);
-  getDoubleParam(waveGenUserDwell_, &dwell);
-  for (i=0; i<numPoints; i++) {
-    waveGenUserTimeBuffer_[i] = (epicsFloat32) (i * dwell);
+  measCompThreadApply(epicsThreadGetNameSelf());
+  while (1) {
+    epicsEventMustWait(waveGenEvent_);
+    lock();
+    while (waveGenRunState_ == waveGenStatePreparing) {
+      status = getWaveGenSetup(&setup);
+      cancel = waveGenCancel_;
+      unlock();
+      if (!status && !cancel) status = prepareWaveGen(&setup);
+      lock();
+      cancel = waveGenCancel_;
+      unlock();
+      if (!status && !cancel) status = armWaveGen(&setup, &dwell);
+      lock();
+      if (!status && !cancel) {
+        publishWaveGen(&setup, dwell);
+        // Settings changed or a stop was requested while the scan was being started
+        if (waveGenCancel_) {
+          stopWaveGen();
+        } else if (waveGenRestart_) {
+          stopWaveGen();
+          queueWaveGenStart();
+        }
+      } else if (!status && !waveGenCancel_) {
+        // The cancel was withdrawn by a new start while the lock was released, so prepare again
+      } else {
+        waveGenRunState_ = waveGenStateIdle;
+        setIntegerParam(waveGenState_, waveGenRunState_);
+        setIntegerParam(waveGenRun_, 0);
+      }
+      callParamCallbacks();
+    }
+    unlock();
+  }
+}
+
+int MultiFunction::stopWaveGen()
+{
+  int err;
+  waveGenRunning_ = 0;
+  waveGenRunState_ = waveGenStateIdle;
+  setIntegerParam(waveGenRun_, 0);
+  setIntegerParam(waveGenState_, waveGenStateIdle);
+  ULMutex_->lock();
+  #ifdef _WIN32
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], err = cbStopBackground(boardNum_, AOFUNCTION));
+  #else
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], err = ulAOutScanStop(daqDeviceHandle_));
+  #endif
+  if (aoScanEvents_) {
+    disableScanEvents(0);
+    aoScanEvents_ = 0;
+  }
+  ULMutex_->unlock();
+  return err;
+}
+
+int MultiFunction::computeWaveGenTimes()
+{
+  int numPoints, i;
+  double dwell;
+
+  getIntegerParam(waveGenUserNumPoints_, &numPoints);
+  getDoubleParam(waveGenUserDwell_, &dwell);
+  for (i=0; i<numPoints; i++) {
+    waveGenUserTimeBuffer_[i] = (epicsFloat32) (i * dwell);
   }
   doCallbacksFloat32Array(waveGenUserTimeBuffer_, numPoints, waveGenUserTimeWF_, 0);
 
@@ -1675,6 +2990,644 @@ int MultiFunction::computeWaveGenTimes()
   return 0;
 }
 
+int MultiFunction::startWaveSeq()
+{
+  int status=0;
+  int enable;
+  int firstChan=-1, lastChan=-1;
+  int seg, numPoints, waveType, userStart;
+  int firstSegment, ringPoints;
+  int extTrigger, extClock;
+  int options;
+  int i;
+  double dwell, pulseWidth;
+  static const char *functionName = "startWaveSeq";
+
+  getIntegerParam(waveGenExtTrigger_,   &extTrigger);
+  getIntegerParam(waveGenExtClock_,     &extClock);
+  getIntegerParam(waveSeqFirstSegment_, &firstSegment);
+  getIntegerParam(waveSeqRingPoints_,   &ringPoints);
+  getDoubleParam(waveSeqDwell_,         &dwell);
+
+  for (i=0; i<numAnalogOut_; i++) {
+    getIntegerParam(i, waveGenEnable_, &enable);
+    if (!enable) continue;
+    if (firstChan < 0) firstChan = i;
+    lastChan = i;
+  }
+  if (firstChan < 0) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR no enabled channels\n",
+      driverName, functionName);
+    return -1;
+  }
+  if ((firstSegment < 0) || (firstSegment >= MAX_WAVESEQ_SEGMENTS)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR first segment=%d must be in the range 0 to %d\n",
+      driverName, functionName, firstSegment, MAX_WAVESEQ_SEGMENTS-1);
+    return -1;
+  }
+  if ((ringPoints < 2) || ((size_t)ringPoints > maxOutputPoints_)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR ring points=%d must be in the range 2 to %d\n",
+      driverName, functionName, ringPoints, (int)maxOutputPoints_);
+    return -1;
+  }
+  if (dwell <= 0.) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR dwell=%f must be positive\n",
+      driverName, functionName, dwell);
+    return -1;
+  }
+
+  // Copy and check all segments and synthesize the pre-defined ones.  Segments with no points are unused.
+  for (seg=0; seg<MAX_WAVESEQ_SEGMENTS; seg++) {
+    waveSeqSegment_t *pSeg = &waveSeqSegDef_[seg];
+    getIntegerParam(seg, waveSeqSegType_,      &pSeg->waveType);
+    getIntegerParam(seg, waveSeqSegNumPoints_, &pSeg->numPoints);
+    getIntegerParam(seg, waveSeqSegUserStart_, &pSeg->userStart);
+    getDoubleParam(seg,  waveSeqSegOffset_,    &pSeg->offset);
+    getDoubleParam(seg,  waveSeqSegAmplitude_, &pSeg->amplitude);
+    getIntegerParam(seg, waveSeqSegRepeat_,    &pSeg->repeat);
+    getIntegerParam(seg, waveSeqSegAdvance_,   &pSeg->advance);
+    getIntegerParam(seg, waveSeqSegNext_,      &pSeg->next);
+    getIntegerParam(seg, waveSeqSegJumpBit_,   &pSeg->jumpBit);
+    getIntegerParam(seg, waveSeqSegJumpTarget_,&pSeg->jumpTarget);
+    numPoints = pSeg->numPoints;
+    waveType  = pSeg->waveType;
+    userStart = pSeg->userStart;
+    if (numPoints < 1) continue;
+    if (waveType == waveTypeUser) {
+      if ((userStart < 0) || ((size_t)userStart + numPoints > maxOutputPoints_)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+          "%s:%s: ERROR segment %d user start=%d + points=%d exceeds maxOutputPoints=%d\n",
+          driverName, functionName, seg, userStart, numPoints, (int)maxOutputPoints_);
+        return -1;
+      }
+      continue;
+    }
+    if ((size_t)numPoints > maxOutputPoints_) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s:%s: ERROR segment %d points=%d exceeds maxOutputPoints=%d\n",
+        driverName, functionName, seg, numPoints, (int)maxOutputPoints_);
+      return -1;
+    }
+    if (numPoints > waveSeqSegBufferSize_[seg]) {
+      free(waveSeqSegBuffer_[seg]);
+      waveSeqSegBuffer_[seg] = (epicsFloat32 *) calloc(numPoints, sizeof(epicsFloat32));
+      waveSeqSegBufferSize_[seg] = numPoints;
+    }
+    getDoubleParam(seg, waveSeqSegPulseWidth_, &pulseWidth);
+    synthesizeWaveform(waveType, numPoints, dwell, pSeg->offset, pSeg->amplitude, pulseWidth, waveSeqSegBuffer_[seg]);
+  }
+  if (waveSeqSegDef_[firstSegment].numPoints < 1) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR first segment %d has no points\n",
+      driverName, functionName, firstSegment);
+    return -1;
+  }
+
+  waveSeqFirstChan_      = firstChan;
+  waveSeqNumChans_       = lastChan - firstChan + 1;
+  waveSeqRingSize_       = ringPoints;
+  waveSeqSegment_        = firstSegment;
+  waveSeqRepeat_         = 0;
+  waveSeqSegPoint_       = 0;
+  waveSeqWriterDone_     = 0;
+  waveSeqTriggerPending_ = 0;
+  waveSeqPrevTriggerBit_ = -1;
+  waveSeqWritePoint_     = 0;
+  waveSeqEndPoint_       = 0;
+  waveSeqPlayedPoint_    = 0;
+  waveSeqTotalCount_     = 0;
+  waveSeqBoundaryHead_   = 0;
+  waveSeqBoundaryTail_   = 0;
+  if (ringPoints + 2 > waveSeqBoundarySize_) {
+    free(waveSeqBoundary_);
+    waveSeqBoundary_ = (waveSeqBoundary_t *) calloc(ringPoints + 2, sizeof(waveSeqBoundary_t));
+    waveSeqBoundarySize_ = ringPoints + 2;
+  }
+  setIntegerParam(waveSeqUnderruns_, 0);
+  // Fill the whole ring before starting the scan
+  fillWaveSeq();
+
+  ULMutex_->lock();
+  #ifdef _WIN32
+    long pointsPerSecond = (long)((1. / dwell) + 0.5);
+    options                  = BACKGROUND | CONTINUOUS;
+    if (extTrigger) options |= EXTTRIGGER;
+    if (extClock)   options |= EXTCLOCK;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = cbAOutScan(boardNum_, firstChan, lastChan, waveSeqNumChans_*ringPoints, &pointsPerSecond, BIP10VOLTS,
+                                                                         waveGenOutBuffer_, options));
+    dwell = (1. / pointsPerSecond);
+  #else
+    options                  = SO_DEFAULTIO | SO_CONTINUOUS;
+    if (extTrigger) options |= SO_EXTTRIGGER;
+    if (extClock)   options |= SO_EXTCLOCK;
+    double rate = 1./dwell;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = ulAOutScan(daqDeviceHandle_, firstChan, lastChan, BIP10VOLTS, ringPoints, &rate, (ScanOption) options, AOUTSCAN_FF_NOSCALEDATA, waveGenOutBuffer_));
+    dwell = 1./rate;
+  #endif
+  ULMutex_->unlock();
+  reportError(status, functionName, "Calling AOutScan");
+  if (status) return status;
+
+  waveSeqRunning_ = 1;
+  aoScanSerial_++;
+  setIntegerParam(waveSeqRun_, 1);
+  setDoubleParam(waveSeqDwellActual_, dwell);
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+    "%s:%s: started sequence, firstChan=%d, lastChan=%d, ringPoints=%d, firstSegment=%d, dwell=%f\n",
+    driverName, functionName, firstChan, lastChan, ringPoints, firstSegment, dwell);
+  return 0;
+}
+
+int MultiFunction::stopWaveSeq()
+{
+  int err;
+  waveSeqRunning_ = 0;
+  setIntegerParam(waveSeqRun_, 0);
+  setIntegerParam(waveSeqCurrentSegment_, -1);
+  ULMutex_->lock();
+  #ifdef _WIN32
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], err = cbStopBackground(boardNum_, AOFUNCTION));
+  #else
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], err = ulAOutScanStop(daqDeviceHandle_));
+  #endif
+  ULMutex_->unlock();
+  return err;
+}
+
+// Writes sequence points into the free part of the AO ring buffer.
+// Ring slots between waveSeqPlayedPoint_ and waveSeqWritePoint_ have not been output yet and are not touched.
+// A trigger therefore takes effect up to WAVESEQ_RING_POINTS points after it arrives.
+int MultiFunction::fillWaveSeq()
+{
+  epicsUInt64 avail;
+  epicsUInt64 ringIndex;
+  int enable[MAX_ANALOG_OUT];
+  waveSeqSegment_t *pSeg;
+  int seg, next;
+  int n, i, j;
+  double volts;
+  epicsFloat32 *inPtr;
+
+  if (waveSeqWritePoint_ >= waveSeqPlayedPoint_ + waveSeqRingSize_) return 0;
+  avail = waveSeqPlayedPoint_ + waveSeqRingSize_ - waveSeqWritePoint_;
+  for (i=0; i<waveSeqNumChans_; i++) {
+    getIntegerParam(waveSeqFirstChan_ + i, waveGenEnable_, &enable[i]);
+  }
+
+  while (avail > 0) {
+    if (waveSeqWriterDone_) {
+      // The sequence has ended, hold the last output values until the poller stops the scan
+      for (; avail > 0; avail--, waveSeqWritePoint_++) {
+        epicsUInt64 prevIndex = ((waveSeqWritePoint_ - 1) % waveSeqRingSize_) * waveSeqNumChans_;
+        ringIndex = (waveSeqWritePoint_ % waveSeqRingSize_) * waveSeqNumChans_;
+        for (i=0; i<waveSeqNumChans_; i++) {
+          waveGenOutBuffer_[ringIndex + i] = waveGenOutBuffer_[prevIndex + i];
+        }
+      }
+      break;
+    }
+    seg = waveSeqSegment_;
+    pSeg = &waveSeqSegDef_[seg];
+    if ((waveSeqSegPoint_ == 0) && (waveSeqRepeat_ == 0)) {
+      // Record where this segment starts so the poller can report the playback position
+      int nextTail = (waveSeqBoundaryTail_ + 1) % waveSeqBoundarySize_;
+      if (nextTail == waveSeqBoundaryHead_) break;
+      waveSeqBoundary_[waveSeqBoundaryTail_].point     = waveSeqWritePoint_;
+      waveSeqBoundary_[waveSeqBoundaryTail_].segment   = seg;
+      waveSeqBoundary_[waveSeqBoundaryTail_].numPoints = pSeg->numPoints;
+      waveSeqBoundaryTail_ = nextTail;
+    }
+    n = pSeg->numPoints - waveSeqSegPoint_;
+    if ((epicsUInt64)n > avail) n = (int)avail;
+
+    for (i=0; i<waveSeqNumChans_; i++) {
+      if (pSeg->waveType == waveTypeUser)
+        inPtr = waveGenUserBuffer_[waveSeqFirstChan_ + i] + pSeg->userStart + waveSeqSegPoint_;
+      else
+        inPtr = waveSeqSegBuffer_[seg] + waveSeqSegPoint_;
+      for (j=0; j<n; j++) {
+        ringIndex = ((waveSeqWritePoint_ + j) % waveSeqRingSize_) * waveSeqNumChans_ + i;
+        if (!enable[i])
+          volts = 0.;
+        else if (pSeg->waveType == waveTypeUser)
+          volts = inPtr[j]*pSeg->amplitude + pSeg->offset;
+        else
+          volts = inPtr[j];
+        waveGenOutBuffer_[ringIndex] = voltsToDACCounts(volts);
+      }
+    }
+    waveSeqSegPoint_   += n;
+    waveSeqWritePoint_ += n;
+    avail              -= n;
+    if (waveSeqSegPoint_ < pSeg->numPoints) continue;
+
+    // End of one repetition of this segment
+    waveSeqSegPoint_ = 0;
+    waveSeqRepeat_++;
+    if (pSeg->advance == waveSeqAdvanceTrigger) {
+      if (!waveSeqTriggerPending_) continue;
+      waveSeqTriggerPending_ = 0;
+    }
+    else if ((pSeg->repeat <= 0) || (waveSeqRepeat_ < pSeg->repeat)) {
+      continue;
+    }
+    // The segment is complete.  Jump if the jump bit is set, otherwise go to the next segment.
+    next = pSeg->next;
+    if ((pSeg->jumpBit >= 0) && (pSeg->jumpBit < 32)) {
+      epicsUInt32 bits;
+      getUIntDigitalParam(0, digitalInput_, &bits, 0xFFFFFFFF);
+      if (bits & (1u << pSeg->jumpBit)) next = pSeg->jumpTarget;
+    }
+    waveSeqRepeat_ = 0;
+    if ((next < 0) || (next >= MAX_WAVESEQ_SEGMENTS) || (waveSeqSegDef_[next].numPoints < 1)) {
+      waveSeqWriterDone_ = 1;
+      waveSeqEndPoint_ = waveSeqWritePoint_;
+    } else {
+      waveSeqSegment_ = next;
+    }
+  }
+  return 0;
+}
+
+// Called from the poller thread with the port locked, with the AO scan status and count it read.
+// Updates the playback position, refills the ring and publishes the segment that is currently being output.
+int MultiFunction::pollWaveSeq(short aoStatus, epicsUInt64 aoCount)
+{
+  int status=0;
+  int triggerBit, underruns;
+  epicsUInt64 totalCount, played;
+  waveSeqBoundary_t *pBoundary;
+  static const char *functionName = "pollWaveSeq";
+
+  #ifdef _WIN32
+    // aoCount is a 32-bit sample count that wraps in long sequences
+    totalCount = waveSeqTotalCount_ + (epicsUInt32)((epicsUInt32)aoCount - (epicsUInt32)waveSeqTotalCount_);
+  #else
+    totalCount = aoCount;
+  #endif
+  waveSeqTotalCount_ = totalCount;
+  played = totalCount / waveSeqNumChans_;
+
+  if (!waveSeqWriterDone_ && (played > waveSeqWritePoint_)) {
+    // The output caught up with the writer and replayed stale ring data
+    getIntegerParam(waveSeqUnderruns_, &underruns);
+    setIntegerParam(waveSeqUnderruns_, underruns+1);
+    asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+      "%s::%s sequencer underrun, played=%llu written=%llu\n",
+      driverName, functionName, (unsigned long long)played, (unsigned long long)waveSeqWritePoint_);
+    // The writer continues the sequence from where it stopped, at the played position.  The boundaries
+    // before the writer's segment have all been played; the writer's segment is moved forward by the
+    // stale points so that the segment, repeat and point PVs describe what is output next.
+    if (waveSeqBoundaryHead_ != waveSeqBoundaryTail_) {
+      int last = (waveSeqBoundaryTail_ + waveSeqBoundarySize_ - 1) % waveSeqBoundarySize_;
+      waveSeqBoundary_[last].point += played - waveSeqWritePoint_;
+      waveSeqBoundaryHead_ = last;
+    }
+    waveSeqWritePoint_ = played;
+  }
+  waveSeqPlayedPoint_ = played;
+
+  getIntegerParam(waveSeqTriggerBit_, &triggerBit);
+  if ((triggerBit >= 0) && (triggerBit < 32)) {
+    epicsUInt32 bits;
+    int bit;
+    getUIntDigitalParam(0, digitalInput_, &bits, 0xFFFFFFFF);
+    bit = (bits >> triggerBit) & 1;
+    if ((waveSeqPrevTriggerBit_ == 0) && bit) waveSeqTriggerPending_ = 1;
+    waveSeqPrevTriggerBit_ = bit;
+  }
+
+  // Drop the boundaries that have been played, the one at the head of the FIFO is the segment
+  // being output now.  This is done before refilling so the FIFO has room for the new segments.
+  while (waveSeqBoundaryHead_ != waveSeqBoundaryTail_) {
+    int next = (waveSeqBoundaryHead_ + 1) % waveSeqBoundarySize_;
+    if ((next == waveSeqBoundaryTail_) || (waveSeqBoundary_[next].point > played)) break;
+    waveSeqBoundaryHead_ = next;
+  }
+
+  fillWaveSeq();
+
+  pBoundary = &waveSeqBoundary_[waveSeqBoundaryHead_];
+  if ((waveSeqBoundaryHead_ != waveSeqBoundaryTail_) && (pBoundary->point <= played)) {
+    epicsUInt64 elapsed = played - pBoundary->point;
+    setIntegerParam(waveSeqCurrentSegment_, pBoundary->segment);
+    setIntegerParam(waveSeqCurrentRepeat_,  (int)(elapsed / pBoundary->numPoints));
+    setIntegerParam(waveSeqSegmentPoint_,   (int)(elapsed % pBoundary->numPoints));
+  }
+
+  if ((waveSeqWriterDone_ && (played >= waveSeqEndPoint_)) || (aoStatus == 0)) {
+    status = stopWaveSeq();
+  }
+  return status;
+}
+
+// CRC-32 (IEEE 802.3) used for WAVEGEN_USER_FILE_CHECKSUM
+static epicsUInt32 crc32Table[256];
+static epicsThreadOnceId crc32Once = EPICS_THREAD_ONCE_INIT;
+
+static void crc32Init(void *)
+{
+  epicsUInt32 c;
+  int i, j;
+
+  for (i=0; i<256; i++) {
+    c = (epicsUInt32) i;
+    for (j=0; j<8; j++) {
+      c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+    }
+    crc32Table[i] = c;
+  }
+}
+
+static epicsUInt32 crc32Update(epicsUInt32 crc, const unsigned char *buf, size_t len)
+{
+  size_t i;
+
+  for (i=0; i<len; i++) {
+    crc = crc32Table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+// Maps a waveform file read-only into memory.  On Windows the file is read into a malloc'd buffer instead.
+static int mapWaveFile(const char *fileName, const unsigned char **pData, size_t *pSize)
+{
+  *pData = 0;
+  *pSize = 0;
+  #ifdef _WIN32
+    FILE *fp = fopen(fileName, "rb");
+    long size;
+    unsigned char *pBuff;
+    if (fp == 0) return errno;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size <= 0) {
+      fclose(fp);
+      return 0;
+    }
+    pBuff = (unsigned char *) malloc(size);
+    if ((pBuff == 0) || (fread(pBuff, 1, size, fp) != (size_t)size)) {
+      free(pBuff);
+      fclose(fp);
+      return EIO;
+    }
+    fclose(fp);
+    *pData = pBuff;
+    *pSize = size;
+  #else
+    struct stat st;
+    void *pMap;
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) return errno;
+    if (fstat(fd, &st) != 0) {
+      int err = errno;
+      close(fd);
+      return err;
+    }
+    if (st.st_size == 0) {
+      close(fd);
+      return 0;
+    }
+    pMap = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping remains valid after the descriptor is closed
+    close(fd);
+    if (pMap == MAP_FAILED) return errno;
+    madvise(pMap, st.st_size, MADV_SEQUENTIAL);
+    *pData = (const unsigned char *) pMap;
+    *pSize = st.st_size;
+  #endif
+  return 0;
+}
+
+static void unmapWaveFile(const unsigned char *pData, size_t size)
+{
+  if (pData == 0) return;
+  #ifdef _WIN32
+    free((void *)pData);
+  #else
+    munmap((void *)pData, size);
+  #endif
+}
+
+int MultiFunction::queueWaveFileLoad(int channel, const char *fileName, int format)
+{
+  static const char *functionName = "queueWaveFileLoad";
+
+  if ((channel < 0) || (channel >= numAnalogOut_)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR channel=%d must be in the range 0 to %d\n",
+      driverName, functionName, channel, numAnalogOut_-1);
+    return -1;
+  }
+  lock();
+  if (waveFilePending_[channel]) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR a file is already being loaded for channel %d\n",
+      driverName, functionName, channel);
+    unlock();
+    return -1;
+  }
+  setStringParam(channel, waveGenUserFile_, fileName);
+  setIntegerParam(channel, waveGenUserFileFormat_, format);
+  setIntegerParam(channel, waveGenUserFileLoad_, 1);
+  setIntegerParam(channel, waveGenUserFileStatus_, waveFileStatusLoading);
+  setDoubleParam(channel, waveGenUserFileProgress_, 0.);
+  waveFilePending_[channel] = 1;
+  callParamCallbacks(channel);
+  unlock();
+  epicsEventSignal(waveFileEvent_);
+  return 0;
+}
+
+void MultiFunction::waveFileThread()
+{
+  int chan;
+  int pending;
+
+  measCompThreadApply(epicsThreadGetNameSelf());
+  while (1) {
+    epicsEventMustWait(waveFileEvent_);
+    for (chan=0; chan<numAnalogOut_; chan++) {
+      lock();
+      pending = waveFilePending_[chan];
+      unlock();
+      if (!pending) continue;
+      loadWaveFile(chan);
+      lock();
+      waveFilePending_[chan] = 0;
+      setIntegerParam(chan, waveGenUserFileLoad_, 0);
+      callParamCallbacks(chan);
+      unlock();
+    }
+  }
+}
+
+// Loads a binary or CSV waveform file into waveGenUserBuffer_[channel].
+// The file is parsed into waveFileBuffer_ without holding the port lock, so a bad file never
+// leaves a partially loaded waveform.  This is called only from waveFileThread.
+int MultiFunction::loadWaveFile(int channel)
+{
+  char fileName[MAX_FILENAME_LEN];
+  char message[MAX_FILENAME_LEN+64];
+  char token[64];
+  int tokenLen=0;
+  int inComment=0;
+  int format;
+  int status;
+  const unsigned char *pData;
+  size_t fileSize, offset, chunk, i;
+  size_t sampleSize=0;
+  size_t numPoints=0;
+  epicsUInt32 crc = 0xFFFFFFFF;
+  epicsFloat32 fval;
+  epicsFloat64 dval;
+  char *endPtr;
+  int lastPercent=0, percent;
+  static const char *functionName = "loadWaveFile";
+
+  epicsThreadOnce(&crc32Once, crc32Init, 0);
+  message[0] = 0;
+
+  lock();
+  getStringParam(channel, waveGenUserFile_, sizeof(fileName), fileName);
+  getIntegerParam(channel, waveGenUserFileFormat_, &format);
+  unlock();
+
+  if (format == waveFileFormatAuto) {
+    const char *ext = strrchr(fileName, '.');
+    format = waveFileFormatFloat32;
+    if (ext && ((epicsStrCaseCmp(ext, ".csv") == 0) || (epicsStrCaseCmp(ext, ".txt") == 0)))
+      format = waveFileFormatCSV;
+  }
+  if (format == waveFileFormatFloat32) sampleSize = sizeof(epicsFloat32);
+  if (format == waveFileFormatFloat64) sampleSize = sizeof(epicsFloat64);
+
+  status = mapWaveFile(fileName, &pData, &fileSize);
+  if (status) {
+    snprintf(message, sizeof(message), "cannot open %s: %s", fileName, strerror(status));
+    goto done;
+  }
+  if (fileSize == 0) {
+    snprintf(message, sizeof(message), "%s is empty", fileName);
+    goto done;
+  }
+  if (sampleSize > 0) {
+    if ((fileSize % sampleSize) != 0) {
+      snprintf(message, sizeof(message), "%s size=%d is not a multiple of %d bytes",
+                    fileName, (int)fileSize, (int)sampleSize);
+      goto done;
+    }
+    if (fileSize/sampleSize > maxOutputPoints_) {
+      snprintf(message, sizeof(message), "%s has %d points, maxOutputPoints=%d",
+                    fileName, (int)(fileSize/sampleSize), (int)maxOutputPoints_);
+      goto done;
+    }
+  }
+
+  // WAVE_FILE_CHUNK_SIZE is a multiple of both sample sizes so binary samples never straddle chunks
+  for (offset=0; offset<fileSize; offset+=chunk) {
+    chunk = fileSize - offset;
+    if (chunk > WAVE_FILE_CHUNK_SIZE) chunk = WAVE_FILE_CHUNK_SIZE;
+    crc = crc32Update(crc, pData+offset, chunk);
+    if (format == waveFileFormatFloat32) {
+      for (i=0; i<chunk; i+=sampleSize) {
+        memcpy(&fval, pData+offset+i, sampleSize);
+        waveFileBuffer_[numPoints++] = fval;
+      }
+    }
+    else if (format == waveFileFormatFloat64) {
+      for (i=0; i<chunk; i+=sampleSize) {
+        memcpy(&dval, pData+offset+i, sampleSize);
+        waveFileBuffer_[numPoints++] = (epicsFloat32) dval;
+      }
+    }
+    else {
+      // CSV parsing copies each token into a bounded buffer because the mapped file is not nul-terminated
+      for (i=offset; i<=offset+chunk; i++) {
+        int c = (i < fileSize) ? pData[i] : '\n';
+        if (i == offset+chunk) {
+          if (i < fileSize) break;
+        }
+        if (inComment) {
+          if (c == '\n') inComment = 0;
+          continue;
+        }
+        if ((c == ',') || (c == ';') || (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == '#')) {
+          if (c == '#') inComment = 1;
+          if (tokenLen == 0) continue;
+          token[tokenLen] = 0;
+          tokenLen = 0;
+          if (numPoints >= maxOutputPoints_) {
+            snprintf(message, sizeof(message), "%s has more than maxOutputPoints=%d points",
+                          fileName, (int)maxOutputPoints_);
+            goto done;
+          }
+          dval = strtod(token, &endPtr);
+          if (*endPtr != 0) {
+            snprintf(message, sizeof(message), "%s point %d: invalid number '%s'",
+                          fileName, (int)numPoints, token);
+            goto done;
+          }
+          waveFileBuffer_[numPoints++] = (epicsFloat32) dval;
+          continue;
+        }
+        if (tokenLen >= (int)sizeof(token)-1) {
+          snprintf(message, sizeof(message), "%s point %d: token too long",
+                        fileName, (int)numPoints);
+          goto done;
+        }
+        token[tokenLen++] = (char) c;
+      }
+    }
+    percent = (int) (100. * (offset + chunk) / fileSize);
+    if (percent > lastPercent) {
+      lastPercent = percent;
+      lock();
+      setDoubleParam(channel, waveGenUserFileProgress_, (double) percent);
+      callParamCallbacks(channel);
+      unlock();
+    }
+  }
+  if (numPoints == 0) {
+    snprintf(message, sizeof(message), "%s contains no points", fileName);
+  }
+
+  done:
+  unmapWaveFile(pData, fileSize);
+  lock();
+  if (message[0]) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR %s\n", driverName, functionName, message);
+    setIntegerParam(channel, waveGenUserFileStatus_, waveFileStatusError);
+    setStringParam(lastErrorMessage_, message);
+    callParamCallbacks(channel);
+    if (channel != 0) callParamCallbacks(0);
+    unlock();
+    return -1;
+  }
+  waveGenBufferMutex_.lock();
+  memcpy(waveGenUserBuffer_[channel], waveFileBuffer_, numPoints*sizeof(epicsFloat32));
+  waveGenBufferMutex_.unlock();
+  setIntegerParam(waveGenUserNumPoints_, (int)numPoints);
+  setIntegerParam(channel, waveGenUserFileChecksum_, (epicsInt32)(crc ^ 0xFFFFFFFF));
+  setDoubleParam(channel, waveGenUserFileProgress_, 100.);
+  setIntegerParam(channel, waveGenUserFileStatus_, waveFileStatusDone);
+  computeWaveGenTimes();
+  doCallbacksFloat32Array(waveGenUserBuffer_[channel], numPoints, waveGenUserWF_, channel);
+  callParamCallbacks(channel);
+  if (channel != 0) callParamCallbacks(0);
+  unlock();
+  asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
+    "%s:%s: loaded %d points from %s into channel %d, checksum=0x%08x\n",
+    driverName, functionName, (int)numPoints, fileName, channel, crc ^ 0xFFFFFFFF);
+  return 0;
+}
+
 int MultiFunction::startWaveDig()
 {
   int firstChan, lastChan, numChans, numPoints;
@@ -1684,6 +3637,7 @@ int MultiFunction::startWaveDig()
   int extTrigger, extClock, continuous, retrigger, burstMode;
   int status;
   int options;
+  int scanEvents, eventPoints;
   double dwell;
   bool invalidScanRate=false;
   static const char *functionName = "startWaveDig";
@@ -1697,11 +3651,23 @@ int MultiFunction::startWaveDig()
   getIntegerParam(waveDigContinuous_, &continuous);
   getIntegerParam(waveDigRetrigger_,  &retrigger);
   getIntegerParam(waveDigBurstMode_,  &burstMode);
+  getIntegerParam(waveDigEventPoints_, &eventPoints);
+  getIntegerParam(scanEvents_,        &scanEvents);
   getDoubleParam(waveDigDwell_, &dwell);
+  if (waveSRRunning_) {
+    // Stimulus-response mode acquires a single record on the shared trigger or clock
+    extTrigger = (waveSRSync_ == waveSRSyncExtTrigger);
+    extClock   = (waveSRSync_ == waveSRSyncExtClock);
+    continuous = 0;
+    retrigger  = 0;
+  }
 
   lastChan = firstChan + numChans - 1;
   setIntegerParam(waveDigCurrentPoint_, 0);
 
+  // The digitizer takes over the AI scan hardware.  The poller restarts the background scan when it stops.
+  stopAnalogInBackground();
+
   // Construct the gain array
   for (i=0; i<numChans; i++) {
     chan = firstChan + i;
@@ -1709,7 +3675,7 @@ int MultiFunction::startWaveDig()
     getIntegerParam(chan, analogInRange_, &range);
     gainArray[i] = range;
   }
-  ULMutex.lock();
+  ULMutex_->lock();
   #ifdef _WIN32
     status = cbALoadQueue(boardNum_, chanArray, gainArray, numChans);
   #else
@@ -1722,11 +3688,18 @@ int MultiFunction::startWaveDig()
     status = ulAInLoadQueue(daqDeviceHandle_, queue, numChans);
     delete[] queue;
   #endif
-  ULMutex.unlock();
+  ULMutex_->unlock();
   reportError(status, functionName, "Calling ALoadQueue");
   if (status) return status;
 
-  ULMutex.lock();
+  // By default the data are serviced about 20 times per record, like the adaptive poll period
+  if (eventPoints <= 0) eventPoints = numPoints / 20;
+  if (eventPoints < 1) eventPoints = 1;
+
+  ULMutex_->lock();
+  // The events must be enabled before the scan is started
+  if (aiScanEvents_) disableScanEvents(1);
+  aiScanEvents_ = scanEvents && (enableScanEvents(1, (unsigned long long)eventPoints * numChans) == 0);
   #ifdef _WIN32
     long pointsPerSecond = (long)((1. / dwell) + 0.5);
     options                  = BACKGROUND;
@@ -1736,8 +3709,8 @@ int MultiFunction::startWaveDig()
     if (continuous) options |= CONTINUOUS;
     if (retrigger)  options |= RETRIGMODE;
     if (burstMode)  options |= BURSTMODE;
-    status = cbAInScan(boardNum_, firstChan, lastChan, numWaveDigChans_*numPoints, &pointsPerSecond, BIP10VOLTS,
-                       pInBuffer_, options);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = cbAInScan(boardNum_, firstChan, lastChan, numWaveDigChans_*numPoints, &pointsPerSecond, BIP10VOLTS,
+                                                                        pInBuffer_, options));
     if (status == BADRATE) invalidScanRate = true;
     // Convert back from pointsPerSecond to dwell, since value might have changed
     dwell = (1. / pointsPerSecond);
@@ -1751,12 +3724,16 @@ int MultiFunction::startWaveDig()
     if (burstMode)  options |= SO_BURSTMODE;
     // This is equivalent to OPTIONS |= SCALEDATA on Windows
     AInScanFlag flags = AINSCAN_FF_DEFAULT;
-    status = ulAInScan(daqDeviceHandle_, firstChan, lastChan, aiInputMode_, BIP10VOLTS, numPoints, &rate, (ScanOption) options, flags, pInBuffer_);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = ulAInScan(daqDeviceHandle_, firstChan, lastChan, aiInputMode_, BIP10VOLTS, numPoints, &rate, (ScanOption) options, flags, pInBuffer_));
     if (status == ERR_BAD_RATE) invalidScanRate = true;
      // Convert back from rate to dwell, since value might have changed
     dwell = (1. / rate);
   #endif
-  ULMutex.unlock();
+  if (status && aiScanEvents_) {
+    disableScanEvents(1);
+    aiScanEvents_ = 0;
+  }
+  ULMutex_->unlock();
 
   if (invalidScanRate) {
     setDoubleParam(waveDigDwellActual_, -9999);
@@ -1768,6 +3745,7 @@ int MultiFunction::startWaveDig()
   if (status) return status;
 
   waveDigRunning_ = 1;
+  aiScanSerial_++;
   setIntegerParam(waveDigRun_, 1);
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
     "%s:%s: called cbAInScan, firstChan=%d, lastChan=%d, numPoints=%d, dwell=%f, options=0x%x\n",
@@ -1781,58 +3759,908 @@ int MultiFunction::stopWaveDig()
 {
   int autoRestart;
   int status;
-  static const char *functionName = "stopWaveDig";
 
   waveDigRunning_ = 0;
   setIntegerParam(waveDigRun_, 0);
   readWaveDig();
   getIntegerParam(waveDigAutoRestart_, &autoRestart);
-  ULMutex.lock();
-  #ifdef _WIN32
-    status = cbStopBackground(boardNum_, AIFUNCTION);
-  #else
-    status = ulAInScanStop(daqDeviceHandle_);
-  #endif
-  ULMutex.unlock();
-  reportError(status, functionName, "Stopping AIn scan");
+  status = stopWaveDigScan();
+  if (waveSRRunning_) {
+    finishWaveSR();
+    return status;
+  }
   if (autoRestart)
     status |= startWaveDig();
   return status;
 }
 
-int MultiFunction::readWaveDig()
+// Stops the AIn scan of the digitizer without reading it or restarting it.  Called with the port locked.
+int MultiFunction::stopWaveDigScan()
 {
-  int firstChan, lastChan;
-  int currentPoint;
-  int i;
-  static const char *functionName = "readWaveDig";
-
-  getIntegerParam(waveDigFirstChan_,    &firstChan);
-  lastChan = firstChan + numWaveDigChans_ - 1;
-  getIntegerParam(waveDigCurrentPoint_, &currentPoint);
+  int status;
+  static const char *functionName = "stopWaveDigScan";
 
-  for (i=firstChan; i<=lastChan; i++) {
-    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-      "%s:%s:, doing callbacks on input %d, first value=%f\n",
-      driverName, functionName, i, waveDigBuffer_[i][0]);
-    doCallbacksFloat64Array(waveDigBuffer_[i], currentPoint, waveDigVoltWF_, i);
+  ULMutex_->lock();
+  #ifdef _WIN32
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = cbStopBackground(boardNum_, AIFUNCTION));
+  #else
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = ulAInScanStop(daqDeviceHandle_));
+  #endif
+  if (aiScanEvents_) {
+    disableScanEvents(1);
+    aiScanEvents_ = 0;
   }
-  doCallbacksFloat64Array(waveDigAbsTimeBuffer_, currentPoint, waveDigAbsTimeWF_, 0);
-  return 0;
+  ULMutex_->unlock();
+  reportError(status, functionName, "Stopping AIn scan");
+  return status;
 }
 
-int MultiFunction::computeWaveDigTimes()
+// Starts a continuous low-rate scan of the voltage inputs into a ring buffer.  The poller
+// publishes the average of the last ANALOG_IN_AVERAGE scans as ANALOG_IN_VALUE, instead of
+// reading each channel with a separate ulAIn call.  Called with the port locked.
+int MultiFunction::startAnalogInBackground()
 {
-  int numPoints, i;
-  double dwell;
-
+  int i, type, range, mode;
+  int numChans=0;
+  short gainArray[MAX_ANALOG_IN], chanArray[MAX_ANALOG_IN];
+  int options;
+  int status;
+  double rate;
+  size_t bufferSize;
+  static const char *functionName = "startAnalogInBackground";
+
+  getIntegerParam(0, analogInMode_, &mode);
+  for (i=0; i<numAnalogIn_; i++) {
+    getIntegerParam(i, analogInType_, &type);
+    if (type != AI_CHAN_TYPE_VOLTAGE) continue;
+    if ((boardType_ == E_1608) && (mode == DIFFERENTIAL) && (i>3)) break;
+    getIntegerParam(i, analogInRange_, &range);
+    chanArray[numChans] = i;
+    gainArray[numChans] = range;
+    aiBgChan_[numChans] = i;
+    numChans++;
+  }
+  if (numChans == 0) return 0;
+  getIntegerParam(analogInAverage_, &aiBgNumAverage_);
+  if (aiBgNumAverage_ < 1) aiBgNumAverage_ = 1;
+  getDoubleParam(analogInBgRate_, &rate);
+  if (rate <= 0.) rate = 1000.;
+
+  // The ring buffer holds about 1 second of data, and at least 4 averages
+  aiBgRingScans_ = (int)rate;
+  if (aiBgRingScans_ < 4*aiBgNumAverage_) aiBgRingScans_ = 4*aiBgNumAverage_;
+  if (aiBgRingScans_ > (int)maxInputPoints_) aiBgRingScans_ = (int)maxInputPoints_;
+  if (aiBgRingScans_ < aiBgNumAverage_) aiBgNumAverage_ = aiBgRingScans_;
+  bufferSize = (size_t)aiBgRingScans_ * numChans;
+  if (bufferSize > aiBgBufferSize_) {
+    free(aiBgBuffer_);
+    aiBgBuffer_ = (epicsFloat64 *)calloc(bufferSize, sizeof(epicsFloat64));
+    aiBgBufferSize_ = bufferSize;
+  }
+  aiBgNumChans_ = numChans;
+
+  ULMutex_->lock();
+  #ifdef _WIN32
+    status = cbALoadQueue(boardNum_, chanArray, gainArray, numChans);
+    if (status == 0) {
+      // Without SCALEDATA the buffer receives 16-bit or 32-bit counts, like cbAIn and cbAIn32
+      long pointsPerSecond = (long)(rate + 0.5);
+      options = BACKGROUND | CONTINUOUS;
+      MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = cbAInScan(boardNum_, chanArray[0], chanArray[numChans-1], (long)bufferSize, &pointsPerSecond,
+                                                                          BIP10VOLTS, aiBgBuffer_, options));
+    }
+  #else
+    AiQueueElement *queue = new AiQueueElement[numChans];
+    for (i=0; i<numChans; i++) {
+      queue[i].channel = chanArray[i];
+      queue[i].inputMode = aiInputMode_;
+      mapRange(gainArray[i], &queue[i].range);
+    }
+    status = ulAInLoadQueue(daqDeviceHandle_, queue, numChans);
+    delete[] queue;
+    if (status == 0) {
+      options = SO_DEFAULTIO | SO_CONTINUOUS;
+      // Raw counts, like ulAIn with AIN_FF_NOSCALEDATA
+      MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = ulAInScan(daqDeviceHandle_, chanArray[0], chanArray[numChans-1], aiInputMode_, BIP10VOLTS,
+                                                                          aiBgRingScans_, &rate, (ScanOption) options, AINSCAN_FF_NOSCALEDATA, aiBgBuffer_));
+    }
+  #endif
+  ULMutex_->unlock();
+  if (status) {
+    // Fall back to reading each channel until the settings are changed
+    reportError(status, functionName, "Starting background AIn scan");
+    aiBgFailed_ = 1;
+    return status;
+  }
+  aiBgRunning_ = 1;
+  aiBgLastCount_ = 0;
+  aiScanSerial_++;
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+    "%s:%s: started background scan, numChans=%d, ringScans=%d, numAverage=%d\n",
+    driverName, functionName, numChans, aiBgRingScans_, aiBgNumAverage_);
+  return 0;
+}
+
+// Stops the background analog input scan.  Called with the port locked.
+int MultiFunction::stopAnalogInBackground()
+{
+  int status;
+  static const char *functionName = "stopAnalogInBackground";
+
+  if (!aiBgRunning_) return 0;
+  aiBgRunning_ = 0;
+  ULMutex_->lock();
+  #ifdef _WIN32
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = cbStopBackground(boardNum_, AIFUNCTION));
+  #else
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = ulAInScanStop(daqDeviceHandle_));
+  #endif
+  ULMutex_->unlock();
+  reportError(status, functionName, "Stopping background AIn scan");
+  return status;
+}
+
+// Enables the Universal Library events for the input (AI) or output (AO) scan.
+// For the input scan the data available event is generated every threshold samples.
+// Called with the device lock held.  Returns non-zero if the device does not support the events,
+// in which case the scan is serviced by polling only.
+int MultiFunction::enableScanEvents(int input, unsigned long long threshold)
+{
+  int status;
+  static const char *functionName = "enableScanEvents";
+
+  #ifdef _WIN32
+    unsigned eventTypes = input ? (ON_DATA_AVAILABLE | ON_END_OF_INPUT_SCAN | ON_SCAN_ERROR) :
+                                  ON_END_OF_OUTPUT_SCAN;
+    status = cbEnableEvent(boardNum_, eventTypes, (unsigned)threshold, scanEventCallbackC, this);
+  #else
+    DaqEventType eventTypes = input ?
+      (DaqEventType)(DE_ON_DATA_AVAILABLE | DE_ON_END_OF_INPUT_SCAN | DE_ON_INPUT_SCAN_ERROR) :
+      (DaqEventType)(DE_ON_END_OF_OUTPUT_SCAN | DE_ON_OUTPUT_SCAN_ERROR);
+    status = ulEnableEvent(daqDeviceHandle_, eventTypes, threshold, scanEventCallbackC, this);
+  #endif
+  if (status) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+      "%s:%s: cannot enable %s scan events, status=%d, polling the scan status instead\n",
+      driverName, functionName, input ? "input" : "output", status);
+  }
+  return status;
+}
+
+// Disables the events enabled by enableScanEvents.  Called with the device lock held.
+int MultiFunction::disableScanEvents(int input)
+{
+  int status;
+
+  #ifdef _WIN32
+    status = cbDisableEvent(boardNum_, input ? (ON_DATA_AVAILABLE | ON_END_OF_INPUT_SCAN | ON_SCAN_ERROR) :
+                                               ON_END_OF_OUTPUT_SCAN);
+  #else
+    status = ulDisableEvent(daqDeviceHandle_, input ?
+      (DaqEventType)(DE_ON_DATA_AVAILABLE | DE_ON_END_OF_INPUT_SCAN | DE_ON_INPUT_SCAN_ERROR) :
+      (DaqEventType)(DE_ON_END_OF_OUTPUT_SCAN | DE_ON_OUTPUT_SCAN_ERROR));
+  #endif
+  return status;
+}
+
+// Called from the Universal Library event thread.  This must not take the port lock or the
+// device lock, since those may be held by a thread that is stopping the scan and waiting for
+// the event thread to exit.  It only records the event and wakes the poller.
+void MultiFunction::scanEvent(unsigned eventType, unsigned long long eventData)
+{
+  unsigned flags=0;
+
+  #ifdef _WIN32
+    if (eventType & ON_DATA_AVAILABLE)     flags |= scanEventInputData;
+    if (eventType & ON_END_OF_INPUT_SCAN)  flags |= scanEventInputEnd;
+    // Windows has a single scan error event, so both scans are checked
+    if (eventType & ON_SCAN_ERROR)         flags |= scanEventInputError | scanEventOutputError;
+    if (eventType & ON_END_OF_OUTPUT_SCAN) flags |= scanEventOutputEnd;
+  #else
+    if (eventType & DE_ON_DATA_AVAILABLE)     flags |= scanEventInputData;
+    if (eventType & DE_ON_END_OF_INPUT_SCAN)  flags |= scanEventInputEnd;
+    if (eventType & DE_ON_INPUT_SCAN_ERROR)   flags |= scanEventInputError;
+    if (eventType & DE_ON_END_OF_OUTPUT_SCAN) flags |= scanEventOutputEnd;
+    if (eventType & DE_ON_OUTPUT_SCAN_ERROR)  flags |= scanEventOutputError;
+  #endif
+  scanEventMutex_.lock();
+  scanEventFlags_ |= flags;
+  numScanEvents_++;
+  // For the scan error events the event data is the error code
+  if (flags & (scanEventInputError | scanEventOutputError)) scanEventError_ = (int)eventData;
+  scanEventMutex_.unlock();
+  epicsEventSignal(scanEvent_);
+}
+
+int MultiFunction::readWaveDig()
+{
+  int firstChan, lastChan;
+  int currentPoint;
+  int i;
+  static const char *functionName = "readWaveDig";
+
+  getIntegerParam(waveDigFirstChan_,    &firstChan);
+  lastChan = firstChan + numWaveDigChans_ - 1;
+  getIntegerParam(waveDigCurrentPoint_, &currentPoint);
+
+  for (i=firstChan; i<=lastChan; i++) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+      "%s:%s:, doing callbacks on input %d, first value=%f\n",
+      driverName, functionName, i, waveDigBuffer_[i][0]);
+    doCallbacksFloat64Array(waveDigBuffer_[i], currentPoint, waveDigVoltWF_, i);
+  }
+  doCallbacksFloat64Array(waveDigAbsTimeBuffer_, currentPoint, waveDigAbsTimeWF_, 0);
+  return 0;
+}
+
+int MultiFunction::computeWaveDigTimes()
+{
+  int numPoints, i;
+  double dwell;
+
   getIntegerParam(waveDigNumPoints_, &numPoints);
   getDoubleParam(waveDigDwell_, &dwell);
   for (i=0; i<numPoints; i++) {
-    waveDigTimeBuffer_[i] = (epicsFloat32) (i * dwell);
+    waveDigTimeBuffer_[i] = (epicsFloat32) (i * dwell);
+  }
+  doCallbacksFloat32Array(waveDigTimeBuffer_, numPoints, waveDigTimeWF_, 0);
+  return 0;
+}
+
+int MultiFunction::startWaveSR()
+{
+  int status;
+  int syncMode;
+  waveGenSetup_t setup;
+  double dwell;
+  epicsTime t0, t1, t2, t3;
+  double startOffset = 0.;
+  static const char *functionName = "startWaveSR";
+
+  if ((waveGenRunState_ != waveGenStateIdle) || waveDigRunning_ || waveSeqRunning_) {
+    reportError(-1, functionName, "waveform generator, digitizer and sequencer must be stopped");
+    setIntegerParam(waveSRRun_, 0);
+    return -1;
+  }
+  getIntegerParam(waveSRSyncMode_, &syncMode);
+  waveSRSync_ = syncMode;
+  waveSRRunning_ = 1;
+
+  // The stimulus is prepared before either scan is started so that the two starts are
+  // as close together as possible.  This runs inline, unlike a normal generator start.
+  status = getWaveGenSetup(&setup);
+  if (!status) status = prepareWaveGen(&setup);
+  if (status) {
+    waveSRRunning_ = 0;
+    setIntegerParam(waveSRRun_, 0);
+    return status;
+  }
+
+  // The digitizer is started first so that it is acquiring before the stimulus begins.
+  // With a shared trigger or clock neither scan runs until the hardware signal arrives.
+  t0 = epicsTime::getCurrent();
+  status = startWaveDig();
+  t1 = epicsTime::getCurrent();
+  if (status) {
+    waveSRRunning_ = 0;
+    setIntegerParam(waveSRRun_, 0);
+    return status;
+  }
+  t2 = epicsTime::getCurrent();
+  status = armWaveGen(&setup, &dwell);
+  t3 = epicsTime::getCurrent();
+  if (status) {
+    // The digitizer is stopped without WAVEDIG_AUTO_RESTART and without analyzing a run that never started
+    waveSRRunning_ = 0;
+    setIntegerParam(waveSRRun_, 0);
+    waveDigRunning_ = 0;
+    setIntegerParam(waveDigRun_, 0);
+    stopWaveDigScan();
+    return status;
+  }
+  publishWaveGen(&setup, dwell);
+  if (waveSRSync_ == waveSRSyncSoftware) {
+    // Midpoint of the generator start call relative to the midpoint of the digitizer start call
+    startOffset = ((t2 - t0) + (t3 - t1)) / 2.;
+  }
+  setDoubleParam(waveSRStartOffset_, startOffset);
+  setIntegerParam(waveSRRun_, 1);
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+    "%s:%s: started stimulus-response, syncMode=%d, startOffset=%g\n",
+    driverName, functionName, waveSRSync_, startOffset);
+  return 0;
+}
+
+int MultiFunction::stopWaveSR()
+{
+  // Stopping the digitizer analyzes whatever has been acquired
+  return stopWaveDig();
+}
+
+// Called from stopWaveDig when the digitizer record is complete or the run is aborted
+int MultiFunction::finishWaveSR()
+{
+  int status=0;
+
+  waveSRRunning_ = 0;
+  if (waveGenRunning_) status = stopWaveGen();
+  analyzeWaveSR();
+  setIntegerParam(waveSRRun_, 0);
+  return status;
+}
+
+// Computes the delay, gain and correlation of each digitizer input relative to the stimulus channel.
+// The stimulus is reconstructed at the digitizer sample times from the D/A values that were output.
+// The delay is the peak of the cross-correlation over lags 0 to WAVESR_MAX_LAG, refined with a
+// parabola through the peak and its neighbours.  The gain is the least-squares gain at the peak lag.
+int MultiFunction::analyzeWaveSR()
+{
+  int stimChan, stimIndex, maxLag, numPoints, aoPoints, aoContinuous, firstChan;
+  int chan, lag, bestLag, n;
+  long long k;
+  double aiDwell, aoDwell, startOffset;
+  double mean, ymean, sxx, syy, r, rBest, delta, gain, corr;
+  double *pCorr;
+  epicsFloat64 *x, *y;
+  static const char *functionName = "analyzeWaveSR";
+
+  getIntegerParam(waveSRStimChan_,      &stimChan);
+  getIntegerParam(waveSRMaxLag_,        &maxLag);
+  getIntegerParam(waveDigCurrentPoint_, &numPoints);
+  getIntegerParam(waveDigFirstChan_,    &firstChan);
+  getIntegerParam(waveGenNumPoints_,    &aoPoints);
+  getIntegerParam(waveGenContinuous_,   &aoContinuous);
+  getDoubleParam(waveDigDwellActual_,   &aiDwell);
+  getDoubleParam(waveGenDwellActual_,   &aoDwell);
+  getDoubleParam(waveSRStartOffset_,    &startOffset);
+
+  stimIndex = stimChan - waveGenFirstChan_;
+  if ((stimIndex < 0) || (stimIndex >= numWaveGenChans_)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR stimulus channel %d was not output\n",
+      driverName, functionName, stimChan);
+    return -1;
+  }
+  if ((numPoints < 3) || (aoPoints < 1) || (aiDwell <= 0.) || (aoDwell <= 0.)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR not enough data, numPoints=%d\n",
+      driverName, functionName, numPoints);
+    return -1;
+  }
+  // With a shared external clock both scans advance on the same edges
+  if (waveSRSync_ == waveSRSyncExtClock) aoDwell = aiDwell;
+  if (maxLag > numPoints - 2) maxLag = numPoints - 2;
+  if (maxLag < 1) maxLag = 1;
+
+  if (waveSRStimBuffer_ == 0) {
+    waveSRStimBuffer_ = (epicsFloat64 *) calloc(maxInputPoints_, sizeof(epicsFloat64));
+  }
+  x = waveSRStimBuffer_;
+  mean = 0.;
+  for (n=0; n<numPoints; n++) {
+    // The D/A holds each point for one dwell time, and holds the first and last points outside the scan
+    k = (long long) floor((n*aiDwell - startOffset) / aoDwell);
+    if (k < 0) k = 0;
+    if (k >= aoPoints) k = aoContinuous ? (k % aoPoints) : (aoPoints - 1);
+    x[n] = waveGenOutBuffer_[k*numWaveGenChans_ + stimIndex] * 20./65535. - 10.;
+    mean += x[n];
+  }
+  mean /= numPoints;
+  for (n=0; n<numPoints; n++) x[n] -= mean;
+
+  pCorr = (double *) calloc(maxLag+1, sizeof(double));
+  for (chan=firstChan; chan<firstChan+numWaveDigChans_; chan++) {
+    y = waveDigBuffer_[chan];
+    ymean = 0.;
+    for (n=0; n<numPoints; n++) ymean += y[n];
+    ymean /= numPoints;
+    bestLag = 0;
+    rBest = -1.e300;
+    for (lag=0; lag<=maxLag; lag++) {
+      r = 0.;
+      for (n=0; n<numPoints-lag; n++) r += x[n] * (y[n+lag] - ymean);
+      pCorr[lag] = r;
+      if (r > rBest) {
+        rBest = r;
+        bestLag = lag;
+      }
+    }
+    delta = 0.;
+    if ((bestLag > 0) && (bestLag < maxLag)) {
+      double denom = pCorr[bestLag-1] - 2.*pCorr[bestLag] + pCorr[bestLag+1];
+      if (denom != 0.) delta = 0.5 * (pCorr[bestLag-1] - pCorr[bestLag+1]) / denom;
+    }
+    sxx = syy = 0.;
+    for (n=0; n<numPoints-bestLag; n++) {
+      sxx += x[n] * x[n];
+      syy += (y[n+bestLag] - ymean) * (y[n+bestLag] - ymean);
+    }
+    gain = (sxx > 0.) ? rBest / sxx : 0.;
+    corr = ((sxx > 0.) && (syy > 0.)) ? rBest / sqrt(sxx * syy) : 0.;
+    setDoubleParam(chan, waveSRDelay_,       (bestLag + delta) * aiDwell);
+    setDoubleParam(chan, waveSRGain_,        gain);
+    setDoubleParam(chan, waveSRCorrelation_, corr);
+    callParamCallbacks(chan);
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+      "%s:%s: input %d lag=%d+%f delay=%g gain=%g correlation=%f\n",
+      driverName, functionName, chan, bestLag, delta, (bestLag + delta) * aiDwell, gain, corr);
+  }
+  free(pCorr);
+  return 0;
+}
+
+// Starts a logic analyzer capture: a hardware-clocked finite ulDInScan of one digital port,
+// optionally started by an edge trigger on the trigger input or a pattern trigger on the port.
+int MultiFunction::startLogic()
+{
+  int port, numPoints, extTrigger, triggerMode, pattern, mask;
+  int options=0;
+  int status=0;
+  double dwell;
+  static const char *functionName = "startLogic";
+
+  getIntegerParam(logicPort_,           &port);
+  getIntegerParam(logicNumPoints_,      &numPoints);
+  getIntegerParam(logicExtTrigger_,     &extTrigger);
+  getIntegerParam(logicTriggerMode_,    &triggerMode);
+  getIntegerParam(logicTriggerPattern_, &pattern);
+  getIntegerParam(logicTriggerMask_,    &mask);
+  getDoubleParam(logicDwell_, &dwell);
+  if ((port < 0) || (port >= numIOPorts_) || digitalIOPortWriteOnly_[port]) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: invalid digital input port %d\n",
+      driverName, functionName, port);
+    setIntegerParam(logicRun_, 0);
+    return -1;
+  }
+  if (numPoints < 1) numPoints = 1;
+  if (numPoints > (int)maxInputPoints_) numPoints = (int)maxInputPoints_;
+  if (dwell <= 0.) dwell = 1.e-3;
+  setIntegerParam(logicCurrentPoint_, 0);
+
+  ULMutex_->lock();
+  #ifdef _WIN32
+    // The pattern triggers compare the port with LowThreshold using HighThreshold as the mask.
+    // Note that this changes the board trigger that TRIGGER_MODE also sets.
+    if (extTrigger) status = cbSetTrigger(boardNum_, triggerMode, (USHORT)pattern, (USHORT)mask);
+    if (status == 0) {
+      long pointsPerSecond = (long)((1. / dwell) + 0.5);
+      options = BACKGROUND;
+      if (extTrigger) options |= EXTTRIGGER;
+      // The buffer receives 16-bit values
+      MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = cbDInScan(boardNum_, digitalIOPort_[port], numPoints, &pointsPerSecond, logicBuffer_, options));
+      dwell = 1. / pointsPerSecond;
+    }
+  #else
+    if (extTrigger) {
+      TriggerType triggerType;
+      status = mapTriggerType(triggerMode, &triggerType);
+      // For the pattern triggers the level is the pattern and the variance is the mask
+      if (status == 0) {
+        status = ulDInSetTrigger(daqDeviceHandle_, triggerType, digitalIOPort_[port], pattern, mask, 0);
+      }
+    }
+    if (status == 0) {
+      double rate = 1. / dwell;
+      options = SO_DEFAULTIO;
+      if (extTrigger) options |= SO_EXTTRIGGER;
+      MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = ulDInScan(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[port], (DigitalPortType)digitalIOPort_[port],
+                                                                          numPoints, &rate, (ScanOption) options, DINSCAN_FF_DEFAULT, logicBuffer_));
+      dwell = 1. / rate;
+    }
+  #endif
+  ULMutex_->unlock();
+  reportError(status, functionName, "Starting logic analyzer capture");
+  if (status) {
+    setIntegerParam(logicRun_, 0);
+    return status;
+  }
+
+  logicRunning_ = 1;
+  logicScanSerial_++;
+  logicPortIndex_ = port;
+  logicDwellUsed_ = dwell;
+  setDoubleParam(logicDwellActual_, dwell);
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+    "%s:%s: started capture, port=%d, numPoints=%d, dwell=%f, options=0x%x\n",
+    driverName, functionName, port, numPoints, dwell, options);
+  return 0;
+}
+
+// Stops the capture, early or when it is complete, and analyzes the points acquired.  Called with the port locked.
+int MultiFunction::stopLogic()
+{
+  int status;
+  int numPoints=0;
+  static const char *functionName = "stopLogic";
+
+  logicRunning_ = 0;
+  setIntegerParam(logicRun_, 0);
+  ULMutex_->lock();
+  #ifdef _WIN32
+    short scanStatus;
+    long count, index;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], cbGetIOStatus(boardNum_, &scanStatus, &count, &index, DIFUNCTION));
+    numPoints = (int)count;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = cbStopBackground(boardNum_, DIFUNCTION));
+  #else
+    ScanStatus scanStatus;
+    TransferStatus xferStatus;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = ulDInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus));
+    if (status == 0) {
+      numPoints = (int)xferStatus.currentScanCount;
+    }
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = ulDInScanStop(daqDeviceHandle_));
+  #endif
+  ULMutex_->unlock();
+  reportError(status, functionName, "Stopping logic analyzer capture");
+  setIntegerParam(logicCurrentPoint_, numPoints);
+  analyzeLogic(numPoints);
+  return status;
+}
+
+// Converts the captured samples into a list of transitions: the time relative to the first sample,
+// the new port value and the bits that changed.  The first entry is the initial value of the port.
+// Called with the port locked.
+int MultiFunction::analyzeLogic(int numPoints)
+{
+  int i, numTransitions=0;
+  epicsUInt32 value, prevValue=0, portMask;
+  int bits = numIOBits_[logicPortIndex_];
+
+  portMask = (bits >= 32) ? 0xFFFFFFFF : ((1u << bits) - 1);
+  if (numPoints > (int)maxInputPoints_) numPoints = (int)maxInputPoints_;
+  for (i=0; i<numPoints; i++) {
+    #ifdef _WIN32
+      value = ((epicsUInt16 *)logicBuffer_)[i] & portMask;
+    #else
+      value = (epicsUInt32)logicBuffer_[i] & portMask;
+    #endif
+    if ((i == 0) || (value != prevValue)) {
+      logicTransTime_[numTransitions]    = i * logicDwellUsed_;
+      logicTransValue_[numTransitions]   = (epicsInt32)value;
+      logicTransChanged_[numTransitions] = (i == 0) ? 0 : (epicsInt32)(value ^ prevValue);
+      numTransitions++;
+    }
+    prevValue = value;
+  }
+  setIntegerParam(logicNumTransitions_, numTransitions);
+  doCallbacksFloat64Array(logicTransTime_,  numTransitions, logicTransTimeWF_,    0);
+  doCallbacksInt32Array(logicTransValue_,   numTransitions, logicTransValueWF_,   0);
+  doCallbacksInt32Array(logicTransChanged_, numTransitions, logicTransChangedWF_, 0);
+  return numTransitions;
+}
+
+// Starts the digital pattern generator: a hardware-clocked ulDOutScan of the user pattern to one
+// digital port, once or continuously.  All the bits of the port must be outputs, and host writes
+// to the port are rejected until the scan stops.  Called with the port locked.
+int MultiFunction::startPatternGen()
+{
+  int port, numPoints, extTrigger, extClock, continuous;
+  int options=0;
+  int status=0;
+  int i;
+  double dwell;
+  epicsUInt32 portMask, direction;
+  static const char *functionName = "startPatternGen";
+
+  getIntegerParam(patternGenPort_,       &port);
+  getIntegerParam(patternGenNumPoints_,  &numPoints);
+  getIntegerParam(patternGenExtTrigger_, &extTrigger);
+  getIntegerParam(patternGenExtClock_,   &extClock);
+  getIntegerParam(patternGenContinuous_, &continuous);
+  getDoubleParam(patternGenDwell_, &dwell);
+  if ((port < 0) || (port >= numIOPorts_)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: invalid digital output port %d\n",
+      driverName, functionName, port);
+    setIntegerParam(patternGenRun_, 0);
+    return -1;
+  }
+  getUIntDigitalParam(port, digitalDirection_, &direction, 0xFFFFFFFF);
+  if (digitalIOPortReadOnly_[port] || ((direction & digitalIOMask_[port]) != digitalIOMask_[port])) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: digital port %d is not configured as all outputs, direction=0x%x\n",
+      driverName, functionName, port, direction);
+    setIntegerParam(patternGenRun_, 0);
+    return -1;
+  }
+  if (numPoints > patternUserPoints_) numPoints = patternUserPoints_;
+  if (numPoints < 1) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: no pattern has been loaded\n",
+      driverName, functionName);
+    setIntegerParam(patternGenRun_, 0);
+    return -1;
+  }
+  if (dwell <= 0.) dwell = 1.e-3;
+  portMask = (numIOBits_[port] >= 32) ? 0xFFFFFFFF : ((1u << numIOBits_[port]) - 1);
+  for (i=0; i<numPoints; i++) {
+    #ifdef _WIN32
+      // cbDOutScan takes 16-bit values
+      ((epicsUInt16 *)patternBuffer_)[i] = (epicsUInt16)(patternUser_[i] & portMask);
+    #else
+      patternBuffer_[i] = (epicsUInt32)patternUser_[i] & portMask;
+    #endif
+  }
+  setIntegerParam(patternGenCurrentPoint_, 0);
+  // Write any coalesced output bits now, the poller must not write the port during the scan
+  flushDigitalOutput(port);
+
+  ULMutex_->lock();
+  #ifdef _WIN32
+    long pointsPerSecond = (long)((1. / dwell) + 0.5);
+    options = BACKGROUND;
+    if (continuous) options |= CONTINUOUS;
+    if (extTrigger) options |= EXTTRIGGER;
+    if (extClock)   options |= EXTCLOCK;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = cbDOutScan(boardNum_, digitalIOPort_[port], numPoints, &pointsPerSecond, patternBuffer_, options));
+    dwell = 1. / pointsPerSecond;
+  #else
+    double rate = 1. / dwell;
+    options = SO_DEFAULTIO;
+    if (continuous) options |= SO_CONTINUOUS;
+    if (extTrigger) options |= SO_EXTTRIGGER;
+    if (extClock)   options |= SO_EXTCLOCK;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = ulDOutScan(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[port], (DigitalPortType)digitalIOPort_[port],
+                                                                         numPoints, &rate, (ScanOption) options, DOUTSCAN_FF_DEFAULT, patternBuffer_));
+    dwell = 1. / rate;
+  #endif
+  ULMutex_->unlock();
+  reportError(status, functionName, "Starting digital pattern generator");
+  if (status) {
+    setIntegerParam(patternGenRun_, 0);
+    return status;
+  }
+
+  patternRunning_ = 1;
+  patternScanSerial_++;
+  patternPortIndex_ = port;
+  patternNumPointsUsed_ = numPoints;
+  patternDwellUsed_ = dwell;
+  setDoubleParam(patternGenDwellActual_, dwell);
+  setDoubleParam(patternGenTotalTime_, dwell * numPoints);
+  for (i=0; i<numPoints; i++) {
+    patternTime_[i] = i * dwell;
+  }
+  doCallbacksFloat64Array(patternTime_, numPoints, patternGenTimeWF_, 0);
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+    "%s:%s: started pattern, port=%d, numPoints=%d, dwell=%f, options=0x%x\n",
+    driverName, functionName, port, numPoints, dwell, options);
+  return 0;
+}
+
+// Stops the digital pattern generator, early or when a one-shot pattern is complete.  Called with the port locked.
+int MultiFunction::stopPatternGen()
+{
+  int status;
+  static const char *functionName = "stopPatternGen";
+
+  patternRunning_ = 0;
+  setIntegerParam(patternGenRun_, 0);
+  ULMutex_->lock();
+  #ifdef _WIN32
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = cbStopBackground(boardNum_, DOFUNCTION));
+  #else
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = ulDOutScanStop(daqDeviceHandle_));
+  #endif
+  ULMutex_->unlock();
+  reportError(status, functionName, "Stopping digital pattern generator");
+  // The port was left at a value of the pattern, so the output shadow is read again before it is used
+  doShadowValid_[patternPortIndex_] = 0;
+  return status;
+}
+
+// Starts a counter scan: a hardware-clocked finite ulCInScan of all the counters, with the
+// counts extended to 64 bits.  Called with the port locked.
+int MultiFunction::startCounterScan()
+{
+  int numPoints, extTrigger;
+  int firstCounter = firstCounter_;
+  int lastCounter = firstCounter_ + numCounters_ - 1;
+  int options=0;
+  int status=0;
+  int i;
+  double dwell;
+  static const char *functionName = "startCounterScan";
+
+  getIntegerParam(counterScanNumPoints_, &numPoints);
+  getIntegerParam(counterScanExtTrigger_, &extTrigger);
+  getDoubleParam(counterScanDwell_, &dwell);
+  if (numCounters_ < 1) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: device has no counters\n",
+      driverName, functionName);
+    setIntegerParam(counterScanRun_, 0);
+    return -1;
+  }
+  if (numPoints < 1) numPoints = 1;
+  if (numPoints*numCounters_ > (int)maxInputPoints_) numPoints = (int)maxInputPoints_ / numCounters_;
+  if (dwell <= 0.) dwell = 1.e-3;
+  if (numPoints > counterScanAllocPoints_) {
+    free(counterScanBuffer_);
+    free(counterScanTime_);
+    counterScanBuffer_ = (epicsUInt64 *)  calloc(numPoints*numCounters_, sizeof(epicsUInt64));
+    counterScanTime_   = (epicsFloat64 *) calloc(numPoints, sizeof(epicsFloat64));
+    for (i=0; i<numCounters_; i++) {
+      free(counterScanCounts_[i]);
+      free(counterScanRate_[i]);
+      free(counterScanPositionBuf_[i]);
+      free(counterScanVelocityBuf_[i]);
+      free(counterScanAccelBuf_[i]);
+      counterScanCounts_[i]      = (epicsFloat64 *) calloc(numPoints, sizeof(epicsFloat64));
+      counterScanRate_[i]        = (epicsFloat64 *) calloc(numPoints, sizeof(epicsFloat64));
+      counterScanPositionBuf_[i] = (epicsFloat64 *) calloc(numPoints, sizeof(epicsFloat64));
+      counterScanVelocityBuf_[i] = (epicsFloat64 *) calloc(numPoints, sizeof(epicsFloat64));
+      counterScanAccelBuf_[i]    = (epicsFloat64 *) calloc(numPoints, sizeof(epicsFloat64));
+    }
+    counterScanAllocPoints_ = numPoints;
+  }
+  setIntegerParam(counterScanCurrentPoint_, 0);
+
+  ULMutex_->lock();
+  #ifdef _WIN32
+    long pointsPerSecond = (long)((1. / dwell) + 0.5);
+    options = BACKGROUND | CTR64BIT;
+    if (extTrigger) options |= EXTTRIGGER;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = cbCInScan(boardNum_, firstCounter, lastCounter, numPoints*numCounters_, &pointsPerSecond,
+                                                                        counterScanBuffer_, options));
+    dwell = 1. / pointsPerSecond;
+  #else
+    double rate = 1. / dwell;
+    options = SO_DEFAULTIO;
+    if (extTrigger) options |= SO_EXTTRIGGER;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = ulCInScan(daqDeviceHandle_, firstCounter, lastCounter, numPoints, &rate, (ScanOption) options,
+                                                                        CINSCAN_FF_CTR64_BIT, counterScanBuffer_));
+    dwell = 1. / rate;
+  #endif
+  ULMutex_->unlock();
+  reportError(status, functionName, "Starting counter scan");
+  if (status) {
+    setIntegerParam(counterScanRun_, 0);
+    return status;
+  }
+
+  counterScanRunning_ = 1;
+  counterScanSerial_++;
+  counterScanDwellUsed_ = dwell;
+  setDoubleParam(counterScanDwellActual_, dwell);
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+    "%s:%s: started counter scan, counters=%d-%d, numPoints=%d, dwell=%f, options=0x%x\n",
+    driverName, functionName, firstCounter, lastCounter, numPoints, dwell, options);
+  return 0;
+}
+
+// Stops the counter scan, early or when it is complete, and publishes the points acquired.  Called with the port locked.
+int MultiFunction::stopCounterScan()
+{
+  int status;
+  int numPoints=0;
+  static const char *functionName = "stopCounterScan";
+
+  counterScanRunning_ = 0;
+  setIntegerParam(counterScanRun_, 0);
+  ULMutex_->lock();
+  #ifdef _WIN32
+    short scanStatus;
+    long count, index;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], cbGetIOStatus(boardNum_, &scanStatus, &count, &index, CTRFUNCTION));
+    numPoints = (int)(count / numCounters_);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = cbStopBackground(boardNum_, CTRFUNCTION));
+  #else
+    ScanStatus scanStatus;
+    TransferStatus xferStatus;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = ulCInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus));
+    if (status == 0) {
+      numPoints = (int)xferStatus.currentScanCount;
+    }
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = ulCInScanStop(daqDeviceHandle_));
+  #endif
+  ULMutex_->unlock();
+  reportError(status, functionName, "Stopping counter scan");
+  setIntegerParam(counterScanCurrentPoint_, numPoints);
+  publishCounterScan(numPoints);
+  return status;
+}
+
+// Configures a counter as an event counter or as a quadrature encoder.  The mode applies to the
+// single-point reads and to the counter scan.  Called with the port locked.
+int MultiFunction::setCounterMode(int counter, int mode)
+{
+  int status;
+  int ulMode;
+  static const char *functionName = "setCounterMode";
+
+  ULMutex_->lock();
+  #ifdef _WIN32
+    switch (mode) {
+      case counterModeEncoderX1: ulMode = ENCODER | ENCODER_MODE_X1; break;
+      case counterModeEncoderX2: ulMode = ENCODER | ENCODER_MODE_X2; break;
+      case counterModeEncoderX4: ulMode = ENCODER | ENCODER_MODE_X4; break;
+      default:                   ulMode = 0; break;
+    }
+    status = cbCConfigScan(boardNum_, firstCounter_ + counter, ulMode, CTR_DEBOUNCE_NONE, CTR_TRIGGER_BEFORE_STABLE,
+                           CTR_RISING_EDGE, CTR_TICK20PT83ns, 0);
+  #else
+    CounterMeasurementType type = CMT_ENCODER;
+    switch (mode) {
+      case counterModeEncoderX1: ulMode = CMM_ENCODER_X1; break;
+      case counterModeEncoderX2: ulMode = CMM_ENCODER_X2; break;
+      case counterModeEncoderX4: ulMode = CMM_ENCODER_X4; break;
+      default:                   ulMode = CMM_DEFAULT; type = CMT_COUNT; break;
+    }
+    status = ulCConfigScan(daqDeviceHandle_, firstCounter_ + counter, type, (CounterMeasurementMode) ulMode,
+                           CED_RISING_EDGE, CTS_TICK_20PT83ns, CDM_NONE, CDT_DEBOUNCE_0ns, CF_DEFAULT);
+  #endif
+  ULMutex_->unlock();
+  reportError(status, functionName, "Calling CConfigScan");
+  if (status) return status;
+  counterMode_[counter] = mode;
+  // The counts from the old mode are not comparable
+  counterRateState_[counter].valid = 0;
+  return 0;
+}
+
+// Converts the first numPoints scans into the time axis and the counts and rates of each counter.
+// The rate of each point is the increment from the previous point divided by the dwell time.
+// For counters in an encoder mode the increment is signed, and it also computes the position,
+// velocity and acceleration.
+// Called with the port locked.
+void MultiFunction::publishCounterScan(int numPoints)
+{
+  epicsUInt64 counts, prevCounts;
+  double delta;
+  int i, j;
+  int diffWidth;
+  double scale, tau, alpha, velocity, accel;
+
+  getIntegerParam(counterScanDiffWidth_, &diffWidth);
+  getDoubleParam(counterScanSmoothTau_, &tau);
+  alpha = (tau > 0.) ? 1. - exp(-counterScanDwellUsed_/tau) : 1.;
+
+  if (numPoints > counterScanAllocPoints_) numPoints = counterScanAllocPoints_;
+  if (numPoints < 1) return;
+  for (i=0; i<numPoints; i++) {
+    counterScanTime_[i] = i * counterScanDwellUsed_;
   }
-  doCallbacksFloat32Array(waveDigTimeBuffer_, numPoints, waveDigTimeWF_, 0);
-  return 0;
+  for (j=0; j<numCounters_; j++) {
+    prevCounts = counterScanBuffer_[j];
+    for (i=0; i<numPoints; i++) {
+      counts = counterScanBuffer_[i*numCounters_ + j];
+      counterScanCounts_[j][i] = (epicsFloat64)counts;
+      if (counterMode_[j] == counterModeCount)
+        delta = (double)(counts - prevCounts);
+      else
+        delta = (epicsInt32)((epicsUInt32)counts - (epicsUInt32)prevCounts);
+      counterScanRate_[j][i] = (i == 0) ? 0. : delta / counterScanDwellUsed_;
+      prevCounts = counts;
+    }
+    doCallbacksFloat64Array(counterScanCounts_[j], numPoints, counterScanCountsWF_, j);
+    doCallbacksFloat64Array(counterScanRate_[j],   numPoints, counterScanRateWF_,   j);
+    if (counterMode_[j] == counterModeCount) continue;
+    // Encoder counts are signed 32-bit positions
+    getDoubleParam(j, counterScanEncoderScale_, &scale);
+    for (i=0; i<numPoints; i++) {
+      counts = counterScanBuffer_[i*numCounters_ + j];
+      counterScanPositionBuf_[j][i] = (epicsInt32)(epicsUInt32)counts * scale;
+    }
+    differentiate(counterScanPositionBuf_[j], counterScanVelocityBuf_[j], numPoints, counterScanDwellUsed_, diffWidth);
+    differentiate(counterScanVelocityBuf_[j], counterScanAccelBuf_[j],    numPoints, counterScanDwellUsed_, diffWidth);
+    // The scalars are exponentially smoothed over the scan
+    velocity = counterScanVelocityBuf_[j][0];
+    accel = counterScanAccelBuf_[j][0];
+    for (i=1; i<numPoints; i++) {
+      velocity += alpha * (counterScanVelocityBuf_[j][i] - velocity);
+      accel    += alpha * (counterScanAccelBuf_[j][i] - accel);
+    }
+    setDoubleParam(j, counterScanPosition_, counterScanPositionBuf_[j][numPoints-1]);
+    setDoubleParam(j, counterScanVelocity_, velocity);
+    setDoubleParam(j, counterScanAccel_, accel);
+    doCallbacksFloat64Array(counterScanPositionBuf_[j], numPoints, counterScanPositionWF_, j);
+    doCallbacksFloat64Array(counterScanVelocityBuf_[j], numPoints, counterScanVelocityWF_, j);
+    doCallbacksFloat64Array(counterScanAccelBuf_[j],    numPoints, counterScanAccelWF_,    j);
+  }
+  doCallbacksFloat64Array(counterScanTime_, numPoints, counterScanTimeWF_, 0);
 }
 
 
@@ -1866,6 +4694,38 @@ asynStatus MultiFunction::writeInt32(asynUser *pasynUser, epicsInt32 value)
   this->getAddress(pasynUser, &addr);
   setIntegerParam(addr, function, value);
 
+  // The poller restarts the background analog input scan with the new settings
+  if ((function == analogInBackground_) || (function == analogInAverage_) ||
+      (function == analogInRange_)      || (function == analogInType_)    ||
+      (function == analogInMode_)) {
+    stopAnalogInBackground();
+    aiBgFailed_ = 0;
+  }
+
+  // Cached temperatures read with the old settings are not used
+  if ((function == temperatureScale_) || (function == temperatureFilter_) ||
+      (function == analogInType_)     || (function == thermocoupleType_)) {
+    if (addr < MAX_TEMPERATURE_IN) {
+      tempCacheTime_[addr] = 0;
+      // The filters start again from the first value with the new settings
+      tempFiltValid_[addr] = 0;
+      tempMedianCount_[addr] = 0;
+    }
+    tempCacheSerial_++;
+  }
+  if ((function == temperatureMedianN_) && (addr < MAX_TEMPERATURE_IN)) {
+    if (value < 1) value = 1;
+    if (value > MAX_TEMP_MEDIAN) value = MAX_TEMP_MEDIAN;
+    setIntegerParam(addr, temperatureMedianN_, value);
+    tempFiltMedianN_[addr] = value;
+    tempMedianPos_[addr] = 0;
+    tempMedianCount_[addr] = 0;
+  }
+  if (function == voltageInRange_) {
+    if (addr < MAX_ANALOG_IN) voltCacheTime_[addr] = 0;
+    voltCacheSerial_++;
+  }
+
   bool isThermocouple = true;
   if (analogInTypeConfigurable_) {
     int ival;
@@ -1873,7 +4733,7 @@ asynStatus MultiFunction::writeInt32(asynUser *pasynUser, epicsInt32 value)
     if (ival != AI_CHAN_TYPE_TC) isThermocouple = false;
   }
 
-  ULMutex.lock();
+  ULMutex_->lock();
   // Analog input functions
   if (function == analogInType_ && analogInTypeConfigurable_) {
     #ifdef _WIN32
@@ -1981,10 +4841,26 @@ asynStatus MultiFunction::writeInt32(asynUser *pasynUser, epicsInt32 value)
   }
   else if ((function == pulseGenCount_) ||
            (function == pulseGenIdleState_)) {
-    if (pulseGenRunning_[addr]) {
-      status = stopPulseGenerator(addr);
-      status |= startPulseGenerator(addr);
-    }
+    status = stagePulseGenerator(addr);
+  }
+  else if (function == pulseGenCommit_) {
+    if (value) status = commitPulseGenerator(addr);
+    setIntegerParam(addr, pulseGenCommit_, 0);
+  }
+  else if (function == pulseGenCommitMode_) {
+    // Staged settings are not left waiting for a commit that will not come
+    if (value != pulseCommitExplicit) status = commitPulseGenerator(addr);
+  }
+
+  else if (function == digitalOutShadow_) {
+    // Write what is pending; the shadow is read back again when it is next enabled
+    flushDigitalOutput(addr);
+    doShadowValid_[addr] = 0;
+  }
+
+  else if (function == latencyReset_) {
+    int op;
+    for (op=0; op<MEAS_COMP_NUM_OPS; op++) ulLatency_[op].reset();
   }
 
   // Counter functions
@@ -1996,6 +4872,8 @@ asynStatus MultiFunction::writeInt32(asynUser *pasynUser, epicsInt32 value)
       status = ulCLoad(daqDeviceHandle_, addr, CRT_LOAD, 0);
     #endif
     reportError(status, functionName, "Resetting counter");
+    // The total and the rates start again from the next read
+    if (addr < MAX_COUNTERS) counterRateState_[addr].valid = 0;
   }
 
   // Trigger functions
@@ -2043,29 +4921,40 @@ asynStatus MultiFunction::writeInt32(asynUser *pasynUser, epicsInt32 value)
 
   // Analog output functions
   else if (function == analogOutValue_) {
-    if (waveGenRunning_) {
+    if (waveGenRunning_ || waveSeqRunning_) {
       reportError(-1, functionName, "cannot write analog outputs while waveform generator is running.");
-      ULMutex.unlock();
+      ULMutex_->unlock();
       return asynError;
     }
     status = getIntegerParam(addr, analogOutRange_, &range);
 
     #ifdef _WIN32
-      status = cbAOut(boardNum_, addr, range, value);
+      MEAS_COMP_TIMED(ulLatency_[measCompOpAOut], status = cbAOut(boardNum_, addr, range, value));
     #else
       Range ulRange;
       mapRange(range, &ulRange);
-      status = ulAOut(daqDeviceHandle_, addr, ulRange, AOUT_FF_NOSCALEDATA, (double) value);
+      MEAS_COMP_TIMED(ulLatency_[measCompOpAOut], status = ulAOut(daqDeviceHandle_, addr, ulRange, AOUT_FF_NOSCALEDATA, (double) value));
     #endif
     reportError(status, functionName, "calling AOut");
   }
 
   // Waveform generator functions
   else if (function == waveGenRun_) {
-    if (value && !waveGenRunning_)
-      status = startWaveGen();
+    if (value && waveSeqRunning_) {
+      reportError(-1, functionName, "cannot start waveform generator while waveform sequencer is running.");
+      setIntegerParam(waveGenRun_, 0);
+      status = -1;
+    }
+    else if (value && (waveGenRunState_ == waveGenStateIdle))
+      status = queueWaveGenStart();
     else if (!value && waveGenRunning_)
       status = stopWaveGen();
+    else if (!value && (waveGenRunState_ == waveGenStatePreparing))
+      // waveGenThread sets the state back to idle when it sees the cancel
+      waveGenCancel_ = 1;
+    else if (value && (waveGenRunState_ == waveGenStatePreparing))
+      // A start after a stop that waveGenThread has not acted on yet, the last write wins
+      waveGenCancel_ = 0;
   }
 
   else if ((function == waveGenWaveType_) ||
@@ -2075,10 +4964,87 @@ asynStatus MultiFunction::writeInt32(asynUser *pasynUser, epicsInt32 value)
       (function == waveGenExtTrigger_)    ||
       (function == waveGenExtClock_)      ||
       (function == waveGenContinuous_)) {
-    defineWaveform(addr);
-    if (waveGenRunning_) {
-      status = stopWaveGen();
-      status |= startWaveGen();
+    if (waveGenRunState_ != waveGenStateIdle) {
+      // The restart prepares the waveforms in waveGenThread
+      if (waveGenRunning_) status = stopWaveGen();
+      status |= queueWaveGenStart();
+    } else {
+      defineWaveform(addr);
+    }
+  }
+
+  // Stimulus-response functions
+  else if (function == waveSRRun_) {
+    if (value && !waveSRRunning_)
+      status = startWaveSR();
+    else if (!value && waveSRRunning_)
+      status = stopWaveSR();
+  }
+
+  // Counter scan functions
+  else if (function == counterScanEncoder_) {
+    // Counters that were never put in an encoder mode are left as the device configured them
+    if ((addr < numCounters_) && (addr < MAX_COUNTERS) && (value != counterMode_[addr])) {
+      if (counterScanRunning_) {
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+          "%s:%s: cannot change the counter mode while the counter scan is running\n",
+          driverName, functionName);
+        setIntegerParam(addr, counterScanEncoder_, counterMode_[addr]);
+        status = -1;
+      } else {
+        status = setCounterMode(addr, value);
+        if (status) setIntegerParam(addr, counterScanEncoder_, counterMode_[addr]);
+      }
+    }
+  }
+  else if (function == counterScanRun_) {
+    if (value && !counterScanRunning_)
+      status = startCounterScan();
+    else if (!value && counterScanRunning_)
+      status = stopCounterScan();
+  }
+
+  // Logic analyzer functions
+  else if (function == logicRun_) {
+    if (value && !logicRunning_)
+      status = startLogic();
+    else if (!value && logicRunning_)
+      status = stopLogic();
+  }
+
+  // Digital pattern generator functions
+  else if (function == patternGenRun_) {
+    if (value && !patternRunning_)
+      status = startPatternGen();
+    else if (!value && patternRunning_)
+      status = stopPatternGen();
+  }
+
+  // Waveform sequencer functions
+  else if (function == waveSeqRun_) {
+    if (value && (waveGenRunState_ != waveGenStateIdle)) {
+      reportError(-1, functionName, "cannot start waveform sequencer while waveform generator is running.");
+      setIntegerParam(waveSeqRun_, 0);
+      status = -1;
+    }
+    else if (value && !waveSeqRunning_)
+      status = startWaveSeq();
+    else if (!value && waveSeqRunning_)
+      status = stopWaveSeq();
+  }
+
+  else if (function == waveSeqTrigger_) {
+    if (value) waveSeqTriggerPending_ = 1;
+    setIntegerParam(waveSeqTrigger_, 0);
+  }
+
+  else if (function == waveGenUserFileLoad_) {
+    if (value) {
+      char fileName[MAX_FILENAME_LEN];
+      int format;
+      getStringParam(addr, waveGenUserFile_, sizeof(fileName), fileName);
+      getIntegerParam(addr, waveGenUserFileFormat_, &format);
+      status = queueWaveFileLoad(addr, fileName, format);
     }
   }
 
@@ -2090,7 +5056,7 @@ asynStatus MultiFunction::writeInt32(asynUser *pasynUser, epicsInt32 value)
     #endif
     reportError(status, functionName, "Setting waveGen trigger count");
   }
-  ULMutex.unlock();
+  ULMutex_->unlock();
 
   // This is a separate if statement because these cases are also treated above
   if ((function == waveGenUserNumPoints_) ||
@@ -2111,13 +5077,92 @@ asynStatus MultiFunction::writeInt32(asynUser *pasynUser, epicsInt32 value)
   return (status==0) ? asynSuccess : asynError;
 }
 
+/** Applies the filter bank to the temperatures just read by the poller and publishes
+  * TEMPERATURE_FILTERED.  Each channel goes through a median of the last TEMPERATURE_MEDIAN_N
+  * values, a limit of TEMPERATURE_RATE_LIMIT degrees/s on the change of the output and a
+  * first-order low-pass with time constant TEMPERATURE_LP_TAU.  A setting of 1 or 0 disables
+  * the corresponding stage.  Open thermocouples are passed through and restart the filters.
+  * Runs only when the temperature subsystem polls, so not while the waveform digitizer runs.
+  * Called with the port locked. */
+void MultiFunction::filterTemperatures(const pollData_t *pPoll)
+{
+  double sorted[MAX_TEMP_MEDIAN];
+  double value, prev, dt, maxStep;
+  int i, j, k, n, count;
+
+  for (i=0; i<numTempChans_ && i<MAX_TEMPERATURE_IN; i++) {
+    if (!pPoll->tempRead[i]) continue;
+    value = pPoll->temperature[i];
+    if (value <= -9999.) {
+      tempFiltValid_[i] = 0;
+      tempMedianCount_[i] = 0;
+      tempFiltered_[i] = value;
+      setDoubleParam(i, temperatureFiltered_, value);
+      continue;
+    }
+    n = tempFiltMedianN_[i];
+    if (n > 1) {
+      tempMedianBuf_[i][tempMedianPos_[i]] = value;
+      tempMedianPos_[i] = (tempMedianPos_[i] + 1) % n;
+      if (tempMedianCount_[i] < n) tempMedianCount_[i]++;
+      count = tempMedianCount_[i];
+      // Insertion sort, the buffers are short
+      for (j=0; j<count; j++) {
+        value = tempMedianBuf_[i][j];
+        for (k=j; (k > 0) && (sorted[k-1] > value); k--) sorted[k] = sorted[k-1];
+        sorted[k] = value;
+      }
+      value = sorted[count/2];
+    }
+    dt = (tempCacheTime_[i] != 0) ? (pPoll->tempTime - tempCacheTime_[i])/1.e9 : 0.;
+    if (tempFiltValid_[i] && (dt > 0.)) {
+      prev = tempFiltered_[i];
+      if (tempFiltRateLimit_[i] > 0.) {
+        maxStep = tempFiltRateLimit_[i] * dt;
+        if (value > prev + maxStep) value = prev + maxStep;
+        if (value < prev - maxStep) value = prev - maxStep;
+      }
+      if (tempFiltTau_[i] > 0.) {
+        value = prev + (1. - exp(-dt/tempFiltTau_[i])) * (value - prev);
+      }
+    }
+    tempFiltered_[i] = value;
+    tempFiltValid_[i] = 1;
+    setDoubleParam(i, temperatureFiltered_, value);
+  }
+}
+
+// Reads one voltage input in volts.  Called with ULMutex_ locked.
+int MultiFunction::readVoltageIn(int addr, int range, double *value)
+{
+  int status;
+
+  #ifdef _WIN32
+    float fVal;
+    MEAS_COMP_TIMED(ulLatency_[measCompOpAIn], status = cbVIn(boardNum_, addr, range, &fVal, 0));
+    *value = fVal;
+  #else
+    double data;
+    Range ulRange;
+    mapRange(range, &ulRange);
+    int chan = addr;
+    if (boardFamily_ == USB_TEMP_AI) {
+      // On Linux the address needs to be 4 larger
+      chan = addr + 4;
+    }
+    MEAS_COMP_TIMED(ulLatency_[measCompOpAIn], status = ulAIn(daqDeviceHandle_, chan, aiInputMode_, ulRange, AIN_FF_DEFAULT, &data));
+    *value = (float) data;
+  #endif
+  return status;
+}
+
 int MultiFunction::setOpenThermocoupleDetect(int addr, int value)
 {
   int status=0;
   static const char *functionName = "setOpenThermocoupleDetect";
 
   if ((boardFamily_ != USB_TEMP) && (boardFamily_ != USB_TEMP_AI)) {
-    ULMutex.lock();
+    ULMutex_->lock();
     #ifdef _WIN32 
       status = cbSetConfig(BOARDINFO, boardNum_, addr, BIDETECTOPENTC, value);
     #else
@@ -2131,7 +5176,7 @@ int MultiFunction::setOpenThermocoupleDetect(int addr, int value)
         status = ulAISetConfig(daqDeviceHandle_, AI_CFG_CHAN_OTD_MODE, addr, mode);
       }
     #endif
-    ULMutex.unlock();
+    ULMutex_->unlock();
     reportError(status, functionName, "Setting thermocouple open detect mode");
   }
   return status;
@@ -2147,14 +5192,24 @@ asynStatus MultiFunction::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
   this->getAddress(pasynUser, &addr);
   setDoubleParam(addr, function, value);
 
+  if (function == analogInBgRate_) {
+    stopAnalogInBackground();
+    aiBgFailed_ = 0;
+  }
+
+  // Temperature filter bank settings
+  if ((function == temperatureLPTau_) && (addr < MAX_TEMPERATURE_IN)) {
+    tempFiltTau_[addr] = value;
+  }
+  if ((function == temperatureRateLimit_) && (addr < MAX_TEMPERATURE_IN)) {
+    tempFiltRateLimit_[addr] = value;
+  }
+
   // Pulse generator functions
   if ((function == pulseGenPeriod_)    ||
       (function == pulseGenDutyCycle_) ||
       (function == pulseGenDelay_)) {
-    if (pulseGenRunning_[addr]) {
-      status = stopPulseGenerator(addr);
-      status |= startPulseGenerator(addr);
-    }
+    status = stagePulseGenerator(addr);
   }
 
   // Waveform generator functions
@@ -2163,10 +5218,12 @@ asynStatus MultiFunction::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
            (function == waveGenPulseWidth_) ||
            (function == waveGenAmplitude_)  ||
            (function == waveGenOffset_)) {
-    defineWaveform(addr);
-    if (waveGenRunning_) {
-      status = stopWaveGen();
-      status |= startWaveGen();
+    if (waveGenRunState_ != waveGenStateIdle) {
+      // The restart prepares the waveforms in waveGenThread
+      if (waveGenRunning_) status = stopWaveGen();
+      status |= queueWaveGenStart();
+    } else {
+      defineWaveform(addr);
     }
   }
 
@@ -2217,14 +5274,22 @@ asynStatus MultiFunction::readFloat64(asynUser *pasynUser, epicsFloat64 *value)
       }
     }
     else {
+      double maxAge;
       getIntegerParam(addr, analogInType_, &type);
       getIntegerParam(addr, temperatureScale_, &scale);
       getIntegerParam(addr, temperatureFilter_, &filter);
+      getDoubleParam(temperatureCacheMaxAge_, &maxAge);
       if (type != AI_CHAN_TYPE_TC) return asynSuccess;
-      ULMutex.lock();
+      // Use the value read by the poller unless it is older than TEMPERATURE_CACHE_MAX_AGE
+      if ((maxAge > 0.) && (addr < MAX_TEMPERATURE_IN) && (tempCacheTime_[addr] != 0) &&
+          ((epicsMonotonicGet() - tempCacheTime_[addr])/1.e9 <= maxAge)) {
+        *value = tempCache_[addr];
+        return asynSuccess;
+      }
+      ULMutex_->lock();
       #ifdef _WIN32
         float fVal;
-        status = cbTIn(boardNum_, addr, scale, &fVal, filter);
+        MEAS_COMP_TIMED(ulLatency_[measCompOpTIn], status = cbTIn(boardNum_, addr, scale, &fVal, filter));
         if (status == OPENCONNECTION) {
           // This is an "expected" error if the thermocouple is broken or disconnected
           // Don't print error message, just set temp to -9999.
@@ -2237,18 +5302,8 @@ asynStatus MultiFunction::readFloat64(asynUser *pasynUser, epicsFloat64 *value)
         TempScale tempScale;
         // cbTin has a filter option but ulTin does not?
         TInFlag flags = TIN_FF_DEFAULT;
-        switch (scale) {
-            case CELSIUS:     tempScale = TS_CELSIUS; break;
-            case FAHRENHEIT:  tempScale = TS_FAHRENHEIT; break;
-            case KELVIN:      tempScale = TS_KELVIN; break;
-            case VOLTS:       tempScale = TS_VOLTS; break;
-            case NOSCALE:     tempScale = TS_NOSCALE; break;
-            default:
-                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                  "%s::%s unsupported Scale=%d\n", driverName, functionName, scale);
-                tempScale = TS_CELSIUS;
-        }
-        status = ulTIn(daqDeviceHandle_, addr, tempScale, flags, value);
+        mapTempScale(scale, &tempScale);
+        MEAS_COMP_TIMED(ulLatency_[measCompOpTIn], status = ulTIn(daqDeviceHandle_, addr, tempScale, flags, value));
         if (status == ERR_OPEN_CONNECTION) {
           // This is an "expected" error if the thermocouple is broken or disconnected
           // Don't print error message, just set temp to -9999.
@@ -2256,31 +5311,26 @@ asynStatus MultiFunction::readFloat64(asynUser *pasynUser, epicsFloat64 *value)
           *value = -9999.;
         }
       #endif
-      ULMutex.unlock();
+      ULMutex_->unlock();
     }
     setDoubleParam(addr, temperatureInValue_, *value);
     reportError(status, functionName, "Calling TIn");
   }
   else if (function == voltageInValue_) {
+    double maxAge;
     getIntegerParam(addr, voltageInRange_, &range);
-    ULMutex.lock();
-    #ifdef _WIN32
-      float fVal;
-      status = cbVIn(boardNum_, addr, range, &fVal, 0);
-      *value = fVal;
-    #else
-      double data;
-      Range ulRange;
-      mapRange(range, &ulRange);
-      int chan = addr;
-      if (boardFamily_ == USB_TEMP_AI) {
-        // On Linux the address needs to be 4 larger
-        chan = addr + 4;
-      }
-      status = ulAIn(daqDeviceHandle_, chan, aiInputMode_, ulRange, AIN_FF_DEFAULT, &data);
-      *value = (float) data;
-    #endif
-    ULMutex.unlock();
+    getDoubleParam(voltageInCacheMaxAge_, &maxAge);
+    // The poller reads the channel from now on.  Use its value unless it is older than
+    // VOLTAGE_IN_CACHE_MAX_AGE.
+    if (addr < MAX_ANALOG_IN) voltUsed_[addr] = 1;
+    if ((maxAge > 0.) && (addr < MAX_ANALOG_IN) && (voltCacheTime_[addr] != 0) &&
+        ((epicsMonotonicGet() - voltCacheTime_[addr])/1.e9 <= maxAge)) {
+      *value = voltCache_[addr];
+      return asynSuccess;
+    }
+    ULMutex_->lock();
+    status = readVoltageIn(addr, range, value);
+    ULMutex_->unlock();
     reportError(status, functionName, "Calling AIn");
     setDoubleParam(addr, voltageInValue_, *value);
   }
@@ -2304,8 +5354,15 @@ asynStatus MultiFunction::writeUInt32Digital(asynUser *pasynUser, epicsUInt32 va
   static const char *functionName = "writeUInt32Digital";
 
   this->getAddress(pasynUser, &addr);
+  if (patternRunning_ && (addr == patternPortIndex_) &&
+      ((function == digitalOutput_) || (function == digitalDirection_))) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+      "%s:%s: port %d is in use by the digital pattern generator\n",
+      driverName, functionName, addr);
+    return asynError;
+  }
   setUIntDigitalParam(addr, function, value, mask);
-  ULMutex.lock();
+  ULMutex_->lock();
   if (function == digitalDirection_) {
     if (digitalIOPortConfigurable_[addr]) {
       #ifdef _WIN32
@@ -2316,6 +5373,8 @@ asynStatus MultiFunction::writeUInt32Digital(asynUser *pasynUser, epicsUInt32 va
         status = ulDConfigPort(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[addr], dir);
       #endif
       reportError(status, functionName, "Calling ConfigPort");
+      // Bits that became outputs are read back into the shadow before the next write
+      doShadowValid_[addr] = 0;
       direction = value ? 0xFFFF : 0;
       setUIntDigitalParam(0, digitalDirection_, direction, 0xFFFFFFFF);
     }
@@ -2331,15 +5390,17 @@ asynStatus MultiFunction::writeUInt32Digital(asynUser *pasynUser, epicsUInt32 va
              status = ulDConfigBit(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[addr], i, dir);
             #endif
             reportError(status, functionName, "Calling ConfigBit");
+            doShadowValid_[addr] = 0;
           }
           else {
             // Cannot program direction.  Set open collector output to 0.
             #ifdef _WIN32
-              status = cbDBitOut(boardNum_, digitalIOPort_[addr], i, 0);
+              MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = cbDBitOut(boardNum_, digitalIOPort_[addr], i, 0));
             #else
-              status = ulDBitOut(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[addr], i, 0);
+              MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = ulDBitOut(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[addr], i, 0));
             #endif
             reportError(status, functionName, "Calling BitOut");
+            doShadow_[addr] &= ~(1<<i);
           }
         }
       }
@@ -2347,38 +5408,45 @@ asynStatus MultiFunction::writeUInt32Digital(asynUser *pasynUser, epicsUInt32 va
   }
 
   else if (function == digitalOutput_) {
+    int shadow;
     getUIntDigitalParam(addr, digitalDirection_, &direction, 0xFFFFFFFF);
-    if ((mask & direction) == digitalIOMask_[addr]) {
+    getIntegerParam(addr, digitalOutShadow_, &shadow);
+    if (shadow) {
+      status = writeDigitalShadow(addr, value, mask);
+    }
+    else if ((mask & direction) == digitalIOMask_[addr]) {
+      doShadowValid_[addr] = 0;
       // Use word I/O if all bits are outputs and we are writing all bits
       #ifdef _WIN32
         if (numIOBits_[addr] > 16) {
-          status = cbDOut32(boardNum_, digitalIOPort_[addr], value & mask);
+          MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = cbDOut32(boardNum_, digitalIOPort_[addr], value & mask));
         } else {
-          status = cbDOut(boardNum_, digitalIOPort_[addr], value & mask);
+          MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = cbDOut(boardNum_, digitalIOPort_[addr], value & mask));
         }
       #else
-        status = ulDOut(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[addr], value & mask);
+        MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = ulDOut(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[addr], value & mask));
       #endif
       reportError(status, functionName, "Calling DOut");
     }
     else {
       // Use bit I/O if we are not writing all bits
       epicsUInt32 outMask, outValue;
+      doShadowValid_[addr] = 0;
       for (i=0, outMask=1; i<numIOBits_[addr]; i++, outMask = (outMask<<1)) {
         // Only write the value if the mask has this bit set and the direction for that bit is output (1)
         outValue = ((value & outMask) == 0) ? 0 : 1;
         if ((mask & outMask & direction) != 0) {
           #ifdef _WIN32
-            status = cbDBitOut(boardNum_, digitalIOPort_[addr], i, outValue);
+            MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = cbDBitOut(boardNum_, digitalIOPort_[addr], i, outValue));
           #else
-            status = ulDBitOut(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[addr], i, outValue);
+            MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = ulDBitOut(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[addr], i, outValue));
           #endif
           reportError(status, functionName, "Calling DBitOut");
         }
       }
     }
   }
-  ULMutex.unlock();
+  ULMutex_->unlock();
 
   callParamCallbacks();
   if (status == 0) {
@@ -2389,6 +5457,186 @@ asynStatus MultiFunction::writeUInt32Digital(asynUser *pasynUser, epicsUInt32 va
   return (status==0) ? asynSuccess : asynError;
 }
 
+/** Writes output bits of a port through its shadow register.
+  * The bits are written immediately if DIGITAL_OUTPUT_COALESCE_MS is 0.  Otherwise the first write
+  * starts the coalescing window and the poller writes all the bits changed within it with one DOut.
+  * Called with the port locked. */
+int MultiFunction::writeDigitalShadow(int port, epicsUInt32 value, epicsUInt32 mask)
+{
+  epicsUInt32 direction;
+  double coalesceMS;
+  int status=0;
+  static const char *functionName = "writeDigitalShadow";
+
+  getUIntDigitalParam(port, digitalDirection_, &direction, 0xFFFFFFFF);
+  mask &= direction & digitalIOMask_[port];
+  if (!doShadowValid_[port]) {
+    // Start from the current state of the outputs.  Write-only ports cannot be read back, so
+    // they start from the last values written through asyn.
+    if (digitalIOPortWriteOnly_[port]) {
+      getUIntDigitalParam(port, digitalOutput_, &doShadow_[port], 0xFFFFFFFF);
+    } else {
+      ULMutex_->lock();
+      #ifdef _WIN32
+        if (numIOBits_[port] > 16) {
+          MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = cbDIn32(boardNum_, digitalIOPort_[port], &doShadow_[port]));
+        } else {
+          epicsUInt16 biVal16;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = cbDIn(boardNum_, digitalIOPort_[port], &biVal16));
+          doShadow_[port] = biVal16;
+        }
+      #else
+        unsigned long long data;
+        MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = ulDIn(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[port], &data));
+        doShadow_[port] = (epicsUInt32)data;
+      #endif
+      ULMutex_->unlock();
+      if (status) {
+        reportError(status, functionName, "Calling DIn to initialize output shadow");
+        return status;
+      }
+    }
+    doShadowValid_[port] = 1;
+  }
+  doShadow_[port] = (doShadow_[port] & ~mask) | (value & mask);
+  getDoubleParam(port, digitalOutCoalesceMS_, &coalesceMS);
+  if (coalesceMS <= 0.) {
+    doPending_[port] |= mask;
+    return flushDigitalOutput(port);
+  }
+  if (mask && !doPending_[port]) {
+    // Wake the poller so that it sleeps only until the end of the window
+    doFlushTime_[port] = epicsTime::getCurrent() + coalesceMS/1000.;
+    epicsEventSignal(scanEvent_);
+  }
+  doPending_[port] |= mask;
+  return 0;
+}
+
+/** Writes the shadow register of a port if it has pending bits.  Called with the port locked. */
+int MultiFunction::flushDigitalOutput(int port)
+{
+  int status;
+  epicsUInt32 outValue;
+  static const char *functionName = "flushDigitalOutput";
+
+  if (!doPending_[port]) return 0;
+  // Bits that are inputs are also written, which only sets their output latch
+  outValue = doShadow_[port] & digitalIOMask_[port];
+  ULMutex_->lock();
+  #ifdef _WIN32
+    if (numIOBits_[port] > 16) {
+      MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = cbDOut32(boardNum_, digitalIOPort_[port], outValue));
+    } else {
+      MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = cbDOut(boardNum_, digitalIOPort_[port], (epicsUInt16)outValue));
+    }
+  #else
+    MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = ulDOut(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[port], outValue));
+  #endif
+  ULMutex_->unlock();
+  doPending_[port] = 0;
+  if (status) {
+    reportError(status, functionName, "Calling DOut");
+    // Read the outputs back before the next write since the state is not known
+    doShadowValid_[port] = 0;
+    return status;
+  }
+  doFlushes_[port]++;
+  setIntegerParam(port, digitalOutFlushes_, doFlushes_[port]);
+  return 0;
+}
+
+/** Returns 1 if the first numPorts ports can be transferred with one DInArray or DOutArray.
+  * The ports must have consecutive port types and all be readable, or all be writable.
+  * Called with the device lock held. */
+int MultiFunction::digitalArrayUsable(int numPorts, int forOutput)
+{
+  int i;
+
+  if (digitalArrayFailed_ || (numPorts < 2)) return 0;
+  for (i=0; i<numPorts; i++) {
+    if (digitalIOPort_[i] != digitalIOPort_[0] + i) return 0;
+    if (forOutput ? digitalIOPortReadOnly_[i] : digitalIOPortWriteOnly_[i]) return 0;
+  }
+  return 1;
+}
+
+/** Writes the first nElements digital I/O ports with a single hold of the device lock, with one
+  * DOutArray if the device supports it.  The shadow registers and the DIGITAL_OUTPUT readbacks of
+  * all the ports are updated together.  Called with the port locked. */
+int MultiFunction::writeDigitalArray(const epicsInt32 *value, size_t nElements)
+{
+  int numPorts = ((int)nElements < numIOPorts_) ? (int)nElements : numIOPorts_;
+  epicsUInt32 outValue[MAX_IO_PORTS];
+  epicsInt32 readback[MAX_IO_PORTS];
+  int arrayDone=0;
+  int status=0;
+  int i;
+  static const char *functionName = "writeDigitalArray";
+
+  if (patternRunning_ && (patternPortIndex_ < numPorts)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: port %d is in use by the digital pattern generator\n",
+      driverName, functionName, patternPortIndex_);
+    return -1;
+  }
+  for (i=0; i<numPorts; i++) {
+    outValue[i] = (epicsUInt32)value[i] & digitalIOMask_[i];
+  }
+  ULMutex_->lock();
+  if (digitalArrayUsable(numPorts, 1)) {
+    #ifdef _WIN32
+      ULONG data[MAX_IO_PORTS];
+      for (i=0; i<numPorts; i++) data[i] = outValue[i];
+      MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = cbDOutArray(boardNum_, digitalIOPort_[0], digitalIOPort_[numPorts-1], data));
+    #else
+      unsigned long long data[MAX_IO_PORTS];
+      for (i=0; i<numPorts; i++) data[i] = outValue[i];
+      MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = ulDOutArray(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[0],
+                                                                       (DigitalPortType)digitalIOPort_[numPorts-1], data));
+    #endif
+    if (status) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+        "%s::%s DOutArray failed, status=%d, writing the ports one at a time\n",
+        driverName, functionName, status);
+      digitalArrayFailed_ = 1;
+      status = 0;
+    } else {
+      arrayDone = 1;
+    }
+  }
+  for (i=0; (i<numPorts) && !arrayDone; i++) {
+    if (digitalIOPortReadOnly_[i]) continue;
+    #ifdef _WIN32
+      if (numIOBits_[i] > 16) {
+        MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = cbDOut32(boardNum_, digitalIOPort_[i], outValue[i]));
+      } else {
+        MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = cbDOut(boardNum_, digitalIOPort_[i], (epicsUInt16)outValue[i]));
+      }
+    #else
+      MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = ulDOut(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[i], outValue[i]));
+    #endif
+    if (status) break;
+  }
+  ULMutex_->unlock();
+  if (status) {
+    reportError(status, functionName, "Writing digital output array");
+    for (i=0; i<numPorts; i++) doShadowValid_[i] = 0;
+    return status;
+  }
+  for (i=0; i<numPorts; i++) {
+    readback[i] = (epicsInt32)outValue[i];
+    if (digitalIOPortReadOnly_[i]) continue;
+    doShadow_[i] = outValue[i];
+    doShadowValid_[i] = 1;
+    doPending_[i] = 0;
+    setUIntDigitalParam(i, digitalOutput_, outValue[i], 0xFFFFFFFF);
+    callParamCallbacks(i);
+  }
+  doCallbacksInt32Array(readback, numPorts, digitalOutputArray_, 0);
+  return 0;
+}
+
 asynStatus MultiFunction::readFloat32Array(asynUser *pasynUser, epicsFloat32 *value, size_t nElements, size_t *nIn)
 {
   int function = pasynUser->reason;
@@ -2427,7 +5675,9 @@ asynStatus MultiFunction::readFloat32Array(asynUser *pasynUser, epicsFloat32 *va
   }
   *nIn = nElements;
   if (*nIn > (size_t) numPoints) *nIn = (size_t) numPoints;
+  waveGenBufferMutex_.lock();
   memcpy(value, inPtr, *nIn*sizeof(epicsFloat32));
+  waveGenBufferMutex_.unlock();
 
   return asynSuccess;
 }
@@ -2454,6 +5704,13 @@ asynStatus MultiFunction::readFloat64Array(asynUser *pasynUser, epicsFloat64 *va
   else if (function == waveDigAbsTimeWF_) {
     inPtr = waveDigAbsTimeBuffer_;
   }
+  else if (function == latencyBinsWF_) {
+    // Lower edge of each latency histogram bin in microseconds
+    for (*nIn=0; (*nIn<nElements) && (*nIn<MEAS_COMP_LATENCY_BINS); (*nIn)++) {
+      value[*nIn] = measCompLatencyHistogram::binLowEdgeUs((int)*nIn);
+    }
+    return asynSuccess;
+  }
   else {
     asynPrint(pasynUser, ASYN_TRACE_ERROR,
       "%s:%s: ERROR: unknown function=%d\n",
@@ -2482,7 +5739,33 @@ asynStatus MultiFunction::writeFloat32Array(asynUser *pasynUser, epicsFloat32 *v
         driverName, functionName, addr, numAnalogOut_-1, (int)nElements, (int)maxOutputPoints_);
       return asynError;
     }
+    waveGenBufferMutex_.lock();
     memcpy(waveGenUserBuffer_[addr], value, nElements*sizeof(epicsFloat32));
+    waveGenBufferMutex_.unlock();
+  }
+  else {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR: unknown function=%d\n",
+      driverName, functionName, function);
+    return asynError;
+  }
+
+  return asynSuccess;
+}
+
+asynStatus MultiFunction::writeInt32Array(asynUser *pasynUser, epicsInt32 *value, size_t nElements)
+{
+  int function = pasynUser->reason;
+  static const char *functionName = "writeInt32Array";
+
+  if (function == digitalOutputArray_) {
+    if (writeDigitalArray(value, nElements)) return asynError;
+  }
+  else if (function == patternGenUserWF_) {
+    // The new pattern is used the next time the pattern generator is started
+    if (nElements > maxOutputPoints_) nElements = maxOutputPoints_;
+    memcpy(patternUser_, value, nElements*sizeof(epicsInt32));
+    patternUserPoints_ = (int)nElements;
   }
   else {
     asynPrint(pasynUser, ASYN_TRACE_ERROR,
@@ -2540,143 +5823,507 @@ asynStatus MultiFunction::readEnum(asynUser *pasynUser, char *strings[], int val
   return asynSuccess;
 }
 
-void MultiFunction::pollerThread()
+// Returns the poll period of a subsystem in seconds.  A period of 0 means POLL_SLEEP_MS,
+// except for the scan status subsystems where it means a period adapted to the running scan,
+// unless that scan is serviced on events.
+// Called with the port locked.
+double MultiFunction::getPollPeriod(int subsystem)
+{
+  double period, pollSleep, scanTime=0., dwell;
+  int numPoints;
+
+  getDoubleParam(subsystem, pollPeriodMS_, &period);
+  getDoubleParam(pollSleepMS_, &pollSleep);
+  if (period > 0.) return period/1000.;
+  if (subsystem == pollSubsystemAnalogOutScan) {
+    if (waveSeqRunning_) {
+      getDoubleParam(waveSeqDwellActual_, &dwell);
+      scanTime = dwell * waveSeqRingSize_;
+    } else {
+      getDoubleParam(waveGenTotalTime_, &scanTime);
+    }
+  } else if (subsystem == pollSubsystemAnalogInScan) {
+    // With scan events the data and the end of the scan are serviced when the events arrive,
+    // so the status is only polled at POLL_SLEEP_MS in case an event is lost
+    if (aiScanEvents_) return pollSleep/1000.;
+    getIntegerParam(waveDigNumPoints_, &numPoints);
+    getDoubleParam(waveDigDwell_, &dwell);
+    scanTime = dwell * numPoints;
+  } else if (subsystem == pollSubsystemLogicScan) {
+    getIntegerParam(logicNumPoints_, &numPoints);
+    scanTime = logicDwellUsed_ * numPoints;
+  } else if (subsystem == pollSubsystemCounterScan) {
+    getIntegerParam(counterScanNumPoints_, &numPoints);
+    scanTime = counterScanDwellUsed_ * numPoints;
+  } else if (subsystem == pollSubsystemPatternGen) {
+    scanTime = patternDwellUsed_ * patternNumPointsUsed_;
+  } else {
+    return pollSleep/1000.;
+  }
+  // Poll a scan about 20 times per scan (or per pass through the sequencer ring),
+  // but never faster than 1 ms or slower than POLL_SLEEP_MS
+  period = scanTime / 20.;
+  if (period > pollSleep/1000.) period = pollSleep/1000.;
+  if (period < 0.001) period = 0.001;
+  return period;
+}
+
+// Returns 1 if a subsystem has anything to poll.  Called with the port locked.
+int MultiFunction::pollSubsystemActive(int subsystem)
 {
-  /* This function runs in a separate thread.  It waits for the poll
-   * time */
-  static const char *functionName = "pollerThread";
-  epicsUInt32 newValue, changedBits, prevInput[MAX_IO_PORTS]={0};
   int i;
-  int currentPoint;
-  epicsUInt32 countVal;
-  long aoCount, aoIndex, aiCount, aiIndex;
-  short aoStatus, aiStatus;
-  epicsTime startTime=epicsTime::getCurrent(), endTime, currentTime;
-  int lastPoint;
-  int status=0, prevStatus=0;
+  double maxAge;
 
-  while(1) {
-    lock();
-    ULMutex.lock();
-    endTime = epicsTime::getCurrent();
-    setDoubleParam(pollTimeMS_, (endTime-startTime)*1000.);
-    startTime = epicsTime::getCurrent();
+  switch (subsystem) {
+    case pollSubsystemDigitalIn:
+      for (i=0; i<numIOPorts_; i++) {
+        if (!digitalIOPortWriteOnly_[i]) return 1;
+      }
+      return 0;
+    case pollSubsystemCounters:
+      // The counter scan reads the counters while it runs
+      return ((numCounters_ > 0) && !counterScanRunning_);
+    case pollSubsystemAnalogOutScan:
+      return (waveGenRunning_ || waveSeqRunning_);
+    case pollSubsystemAnalogInScan:
+      return waveDigRunning_;
+    case pollSubsystemAnalogIn:
+      return (!waveDigRunning_ && (numAnalogIn_ > 0));
+    case pollSubsystemLogicScan:
+      return logicRunning_;
+    case pollSubsystemCounterScan:
+      return counterScanRunning_;
+    case pollSubsystemTemperature:
+      // While the waveform digitizer runs the temperatures come from its buffer, and the filters are not updated
+      if (waveDigRunning_ || (numTempChans_ <= 0)) return 0;
+      getDoubleParam(temperatureCacheMaxAge_, &maxAge);
+      if (maxAge > 0.) return 1;
+      // The filters need the poller even when the cache is disabled
+      for (i=0; i<numTempChans_ && i<MAX_TEMPERATURE_IN; i++) {
+        if ((tempFiltTau_[i] > 0.) || (tempFiltMedianN_[i] > 1) || (tempFiltRateLimit_[i] > 0.)) return 1;
+      }
+      return 0;
+    case pollSubsystemVoltageIn:
+      getDoubleParam(voltageInCacheMaxAge_, &maxAge);
+      if (maxAge <= 0.) return 0;
+      for (i=0; i<MAX_ANALOG_IN; i++) {
+        if (voltUsed_[i]) return 1;
+      }
+      return 0;
+    case pollSubsystemPatternGen:
+      return patternRunning_;
+  }
+  return 0;
+}
+
+// Does the USB transactions for one subsystem and stages the results in *pPoll.
+// Called with only the device lock held.  Returns the UL status; sets pPoll->fatal if the
+// rest of the cycle should be skipped.
+int MultiFunction::pollRead(int subsystem, pollData_t *pPoll)
+{
+  int status=0;
+  int i;
+
+  switch (subsystem) {
+    case pollSubsystemDigitalIn:
+      if ((pPoll->logicPort < 0) && digitalArrayUsable(numIOPorts_, 0)) {
+        // Read all the ports in one transaction
+        #ifdef _WIN32
+          ULONG data[MAX_IO_PORTS];
+          MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = cbDInArray(boardNum_, digitalIOPort_[0], digitalIOPort_[numIOPorts_-1], data));
+        #else
+          unsigned long long data[MAX_IO_PORTS];
+          MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = ulDInArray(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[0],
+                                                                         (DigitalPortType)digitalIOPort_[numIOPorts_-1], data));
+        #endif
+        if (status == 0) {
+          for (i=0; i<numIOPorts_; i++) pPoll->digitalIn[i] = (epicsUInt32)data[i];
+          break;
+        }
+        // Not supported by this device, read the ports one at a time from now on
+        digitalArrayFailed_ = 1;
+        status = 0;
+      }
+      for (i=0; i<numIOPorts_; i++) {
+        if (digitalIOPortWriteOnly_[i]) continue;
+        // The port being captured by the logic analyzer is read by the scan
+        if (i == pPoll->logicPort) continue;
+        #ifdef _WIN32
+          epicsUInt16 biVal16;
+          if (numIOBits_[i] > 16) {
+            MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = cbDIn32(boardNum_, digitalIOPort_[i], &pPoll->digitalIn[i]));
+          } else {
+            MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = cbDIn(boardNum_, digitalIOPort_[i], &biVal16));
+            pPoll->digitalIn[i] = biVal16;
+          }
+        #else
+          unsigned long long data;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = ulDIn(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[i], &data));
+          pPoll->digitalIn[i] = (epicsUInt32) data;
+        #endif
+        if (status) {
+          pPoll->errorMessage = "Calling DIn";
+          pPoll->errorPort = i;
+          pPoll->fatal = 1;
+          return status;
+        }
+      }
+      break;
+
+    case pollSubsystemCounters:
+      for (i=0; i<numCounters_; i++) {
+        #ifdef _WIN32
+          ULONG data;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpCIn], status = cbCIn32(boardNum_, firstCounter_ + i, &data));
+          pPoll->counts[i] = (epicsUInt32)data;
+          pPoll->countTime[i] = epicsMonotonicGet();
+        #else
+          unsigned long long data;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpCIn], status = ulCIn(daqDeviceHandle_, firstCounter_ + i, &data));
+          pPoll->counts[i] = (epicsUInt32)data;
+          pPoll->countTime[i] = epicsMonotonicGet();
+        #endif
+        if (status) {
+          pPoll->errorMessage = "Calling CIn";
+          pPoll->fatal = 1;
+          return status;
+        }
+      }
+      break;
+
+    case pollSubsystemAnalogOutScan:
+      // Poll the status of the waveform generator or sequencer output
+      #ifdef _WIN32
+        MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = cbGetIOStatus(boardNum_, &pPoll->aoStatus, &pPoll->aoCount, &pPoll->aoIndex, AOFUNCTION));
+        pPoll->aoTotalCount = (epicsUInt32)pPoll->aoCount;
+      #else
+        {
+          ScanStatus scanStatus;
+          TransferStatus xferStatus;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = ulAOutScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus));
+          pPoll->aoStatus = scanStatus;
+          pPoll->aoCount = xferStatus.currentTotalCount;
+          pPoll->aoIndex = xferStatus.currentIndex;
+          pPoll->aoTotalCount = xferStatus.currentTotalCount;
+        }
+      #endif
+      if (status) {
+        pPoll->errorMessage = "Calling AOutScanStatus";
+        pPoll->fatal = 1;
+      }
+      break;
+
+    case pollSubsystemAnalogInScan:
+      // Poll the status of the waveform digitizer input
+      #ifdef _WIN32
+        MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = cbGetIOStatus(boardNum_, &pPoll->aiStatus, &pPoll->aiCount, &pPoll->aiIndex, AIFUNCTION));
+      #else
+        {
+          ScanStatus scanStatus;
+          TransferStatus xferStatus;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = ulAInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus));
+          pPoll->aiStatus = scanStatus;
+          pPoll->aiCount = xferStatus.currentTotalCount;
+          pPoll->aiIndex = xferStatus.currentIndex;
+        }
+      #endif
+      if (status) {
+        pPoll->errorMessage = "Calling AInScanStatus";
+        #ifdef _WIN32
+          pPoll->fatal = 1;
+        #endif
+      }
+      break;
+
+    case pollSubsystemAnalogIn:
+      if (pPoll->analogInBackground) {
+        // The background scan is running so only its position is needed
+        #ifdef _WIN32
+          long bgCount;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = cbGetIOStatus(boardNum_, &pPoll->bgStatus, &bgCount, &pPoll->bgIndex, AIFUNCTION));
+          pPoll->bgCount = (epicsUInt32)bgCount;
+        #else
+          ScanStatus scanStatus;
+          TransferStatus xferStatus;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = ulAInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus));
+          pPoll->bgStatus = scanStatus;
+          pPoll->bgCount = (epicsUInt32)xferStatus.currentTotalCount;
+          pPoll->bgIndex = (long)xferStatus.currentIndex;
+        #endif
+        if (status) pPoll->errorMessage = "Calling AInScanStatus for background scan";
+        break;
+      }
+      // The waveform digitizer is not running so read the analog inputs
+      for (i=0; i<numAnalogIn_; i++) {
+        if (pPoll->analogInType[i] != AI_CHAN_TYPE_VOLTAGE) continue;
+        if ((boardType_ == E_1608) && (pPoll->analogInMode == DIFFERENTIAL) && (i>3)) break;
+        #ifdef _WIN32
+          if (ADCResolution_ <= 16) {
+            epicsUInt16 shortVal;
+            MEAS_COMP_TIMED(ulLatency_[measCompOpAIn], status = cbAIn(boardNum_, i, pPoll->analogInRange[i], &shortVal));
+            pPoll->analogIn[i] = shortVal;
+          } else {
+            ULONG ulongVal;
+            MEAS_COMP_TIMED(ulLatency_[measCompOpAIn], status = cbAIn32(boardNum_, i, pPoll->analogInRange[i], &ulongVal, 0));
+            pPoll->analogIn[i] = (epicsInt32)ulongVal;
+          }
+        #else
+          double data;
+          Range ulRange;
+          mapRange(pPoll->analogInRange[i], &ulRange);
+          MEAS_COMP_TIMED(ulLatency_[measCompOpAIn], status = ulAIn(daqDeviceHandle_, i, aiInputMode_, ulRange, AIN_FF_NOSCALEDATA, &data));
+          pPoll->analogIn[i] = (epicsInt32) data;
+        #endif
+        pPoll->analogInRead[i] = 1;
+      }
+      break;
 
-    // Read the digital inputs
-    for (i=0; i<numIOPorts_; i++) {
-      if (digitalIOPortWriteOnly_[i]) continue;
+    case pollSubsystemLogicScan:
+      // Poll the status of the logic analyzer capture
       #ifdef _WIN32
-        epicsUInt16 biVal16;
-        if (numIOBits_[i] > 16) {
-          status = cbDIn32(boardNum_, digitalIOPort_[i], &newValue);
-        } else {
-          status = cbDIn(boardNum_, digitalIOPort_[i], &biVal16);
-          newValue = biVal16;
-        }
+        long logicIndex;
+        MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = cbGetIOStatus(boardNum_, &pPoll->logicStatus, &pPoll->logicCount, &logicIndex, DIFUNCTION));
       #else
-        unsigned long long data;
-        status = ulDIn(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[i], &data);
-        newValue = (epicsUInt32) data;
-      #endif
-      if (status) {
-        if (!prevStatus) {
-          reportError(status, functionName, "Calling DIn");
-          asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "portNumber=%d\n", i);
+        {
+          ScanStatus scanStatus;
+          TransferStatus xferStatus;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = ulDInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus));
+          pPoll->logicStatus = scanStatus;
+          pPoll->logicCount = (long)xferStatus.currentScanCount;
         }
-        goto error;
-      }
-      changedBits = newValue ^ prevInput[i];
-      if (forceCallback_[i] || (changedBits != 0)) {
-        prevInput[i] = newValue;
-        forceCallback_[i] = 0;
-        setUIntDigitalParam(i, digitalInput_, newValue, 0xFFFFFFFF);
-      }
-    }
+      #endif
+      if (status) pPoll->errorMessage = "Calling DInScanStatus";
+      break;
 
-    // Read the counter inputs
-    for (i=0; i<numCounters_; i++) {
+    case pollSubsystemCounterScan:
+      // Poll the status of the counter scan
       #ifdef _WIN32
-        ULONG data;
-        status = cbCIn32(boardNum_, firstCounter_ + i, &data);
-        countVal = (epicsUInt32)data;
+        long counterScanIndex;
+        MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = cbGetIOStatus(boardNum_, &pPoll->counterScanStatus, &pPoll->counterScanCount, &counterScanIndex, CTRFUNCTION));
+        // The count is in values, not in scans of all the counters
+        if (numCounters_ > 0) pPoll->counterScanCount /= numCounters_;
       #else
-        unsigned long long data;
-        status = ulCIn(daqDeviceHandle_, firstCounter_ + i, &data);
-        countVal = (epicsUInt32)data;
+        {
+          ScanStatus scanStatus;
+          TransferStatus xferStatus;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = ulCInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus));
+          pPoll->counterScanStatus = scanStatus;
+          pPoll->counterScanCount = (long)xferStatus.currentScanCount;
+        }
       #endif
-      if (status) {
-        if (!prevStatus) {
-          reportError(status, functionName, "Calling CIn");
+      if (status) pPoll->errorMessage = "Calling CInScanStatus";
+      break;
+
+    case pollSubsystemTemperature: {
+      // Read each run of consecutive thermocouple channels with the same settings in one call
+      int first, last;
+      for (first=0; first<numTempChans_ && first<MAX_TEMPERATURE_IN; first=last+1) {
+        last = first;
+        if (pPoll->tempType[first] != AI_CHAN_TYPE_TC) continue;
+        while ((last+1 < numTempChans_) && (last+1 < MAX_TEMPERATURE_IN) &&
+               (pPoll->tempType[last+1] == AI_CHAN_TYPE_TC) &&
+               (pPoll->tempScale[last+1] == pPoll->tempScale[first]) &&
+               (pPoll->tempFilter[last+1] == pPoll->tempFilter[first])) last++;
+        int runStatus;
+        #ifdef _WIN32
+          float fVal[MAX_TEMPERATURE_IN];
+          MEAS_COMP_TIMED(ulLatency_[measCompOpTIn], runStatus = cbTInScan(boardNum_, first, last, pPoll->tempScale[first], fVal, pPoll->tempFilter[first]));
+          // Open thermocouples read -9999 and are not an error
+          if (runStatus == OPENCONNECTION) runStatus = 0;
+          for (i=first; i<=last; i++) pPoll->temperature[i] = fVal[i-first];
+        #else
+          TempScale tempScale;
+          mapTempScale(pPoll->tempScale[first], &tempScale);
+          MEAS_COMP_TIMED(ulLatency_[measCompOpTIn], runStatus = ulTInArray(daqDeviceHandle_, first, last, tempScale, TINARRAY_FF_DEFAULT, &pPoll->temperature[first]));
+          // Open thermocouples read -9999 and are not an error
+          if (runStatus == ERR_OPEN_CONNECTION) runStatus = 0;
+        #endif
+        if (runStatus) {
+          if (!status) status = runStatus;
+          pPoll->errorMessage = "Calling TInArray";
+          continue;
         }
-        goto error;
+        for (i=first; i<=last; i++) pPoll->tempRead[i] = 1;
       }
-      setIntegerParam(i, counterCounts_, countVal);
+      pPoll->tempTime = epicsMonotonicGet();
+      break;
     }
 
-    if (waveGenRunning_) {
-      // Poll the status of the waveform generator output
-      #ifdef _WIN32
-        status = cbGetIOStatus(boardNum_, &aoStatus, &aoCount, &aoIndex, AOFUNCTION);
-      #else
-        ScanStatus scanStatus;
-        TransferStatus xferStatus;
-        status = ulAOutScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus);
-        aoStatus = scanStatus;
-        aoCount = xferStatus.currentTotalCount;
-        aoIndex = xferStatus.currentIndex;
-      #endif
-      if (status) {
-        if (!prevStatus) {
-          reportError(status, functionName, "Calling AOutScanStatus");
+    case pollSubsystemVoltageIn:
+      // Read all the channels in one hold of the device lock, so that record reads do not
+      // need the lock at all
+      for (i=0; i<MAX_ANALOG_IN; i++) {
+        if (!pPoll->voltUsed[i]) continue;
+        int chanStatus = readVoltageIn(i, pPoll->voltRange[i], &pPoll->voltage[i]);
+        if (chanStatus) {
+          if (!status) status = chanStatus;
+          pPoll->errorMessage = "Calling AIn for voltage input";
+          continue;
         }
-        goto error;
-      } else {
-        asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
-          "%s::%s waveform generator status, aoStatus=%d, aoCount=%ld, aoIndex=%ld\n",
-          driverName, functionName, aoStatus, aoCount, aoIndex);
-      }
-      currentPoint = (aoIndex / numWaveGenChans_) + 1;
-      setIntegerParam(waveGenCurrentPoint_, currentPoint);
-      if (aoStatus == 0) {
-        stopWaveGen();
+        pPoll->voltRead[i] = 1;
       }
-    }
+      pPoll->voltTime = epicsMonotonicGet();
+      break;
 
-    if (waveDigRunning_) {
-      // Poll the status of the waveform digitizer input
+    case pollSubsystemPatternGen:
+      // Poll the status of the digital pattern generator
       #ifdef _WIN32
-        status = cbGetIOStatus(boardNum_, &aiStatus, &aiCount, &aiIndex, AIFUNCTION);
+        MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = cbGetIOStatus(boardNum_, &pPoll->patternStatus, &pPoll->patternCount, &pPoll->patternIndex, DOFUNCTION));
       #else
-        ScanStatus scanStatus;
-        TransferStatus xferStatus;
-        status = ulAInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus);
-        aiStatus = scanStatus;
-        aiCount = xferStatus.currentTotalCount;
-        aiIndex = xferStatus.currentIndex;
+        {
+          ScanStatus scanStatus;
+          TransferStatus xferStatus;
+          MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = ulDOutScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus));
+          pPoll->patternStatus = scanStatus;
+          pPoll->patternCount = (long)xferStatus.currentScanCount;
+          pPoll->patternIndex = (long)xferStatus.currentIndex;
+        }
       #endif
-      if (status) {
-        if (!prevStatus) {
-          reportError(status, functionName, "Calling AInScanStatus");
+      if (status) pPoll->errorMessage = "Calling DOutScanStatus";
+      break;
+  }
+  return status;
+}
+
+// Updates the 64-bit total and the rates of a counter from a new read.
+// COUNTER_RATE is from the last two reads, COUNTER_RATE_EMA is smoothed exponentially with time
+// constant COUNTER_RATE_TAU, and COUNTER_RATE_WINDOWED is over the last COUNTER_RATE_WINDOW seconds.
+// All use the time of the reads, not of the poll.  Called with the port locked.
+void MultiFunction::updateCounterRate(int counter, epicsUInt32 counts, epicsUInt64 readTime)
+{
+  counterRate_t *pRate = &counterRateState_[counter];
+  double tau, window, dt, rate;
+  int first, last, next;
+  int encoder = (counterMode_[counter] != counterModeCount);
+  epicsInt64 delta;
+
+  getDoubleParam(counter, counterRateTau_, &tau);
+  getDoubleParam(counter, counterRateWindow_, &window);
+  if (!pRate->valid) {
+    pRate->valid = 1;
+    // An encoder position is a signed 32-bit count
+    pRate->total = encoder ? (epicsInt64)(epicsInt32)counts : (epicsInt64)counts;
+    pRate->emaValid = 0;
+    pRate->firstSample = 0;
+    pRate->numSamples = 0;
+  } else {
+    dt = (readTime - pRate->prevTime)/1e9;
+    if (dt <= 0.) return;
+    // Unsigned subtraction gives the increment across a wrap of the 32-bit counter.
+    // An encoder can also move backwards so its increment is signed.
+    if (encoder)
+      delta = (epicsInt32)(counts - pRate->prevCounts);
+    else
+      delta = (epicsUInt32)(counts - pRate->prevCounts);
+    pRate->total += delta;
+    rate = (double)delta/dt;
+    if (!pRate->emaValid || (tau <= 0.)) {
+      pRate->rateEMA = rate;
+      pRate->emaValid = 1;
+    } else {
+      pRate->rateEMA += (1. - exp(-dt/tau)) * (rate - pRate->rateEMA);
+    }
+    setDoubleParam(counter, counterRate_, rate);
+    setDoubleParam(counter, counterRateEMA_, pRate->rateEMA);
+  }
+  pRate->prevCounts = counts;
+  pRate->prevTime = readTime;
+  setDoubleParam(counter, counterTotal_, (double)pRate->total);
+
+  // Add this read to the window, dropping the oldest one if the ring is full
+  if (pRate->numSamples == MAX_COUNTER_RATE_SAMPLES) {
+    pRate->firstSample = (pRate->firstSample + 1) % MAX_COUNTER_RATE_SAMPLES;
+    pRate->numSamples--;
+  }
+  last = (pRate->firstSample + pRate->numSamples) % MAX_COUNTER_RATE_SAMPLES;
+  pRate->sampleTime[last] = readTime;
+  pRate->sampleTotal[last] = pRate->total;
+  pRate->numSamples++;
+  // Drop the oldest read while the next one already covers the window
+  while (pRate->numSamples > 2) {
+    next = (pRate->firstSample + 1) % MAX_COUNTER_RATE_SAMPLES;
+    if ((readTime - pRate->sampleTime[next])/1e9 < window) break;
+    pRate->firstSample = next;
+    pRate->numSamples--;
+  }
+  if (pRate->numSamples >= 2) {
+    first = pRate->firstSample;
+    dt = (pRate->sampleTime[last] - pRate->sampleTime[first])/1e9;
+    if (dt > 0.) {
+      setDoubleParam(counter, counterRateWindowed_, (double)(pRate->sampleTotal[last] - pRate->sampleTotal[first])/dt);
+    }
+  }
+}
+
+// Updates the parameters from the results staged by pollRead.  Called with the port locked.
+// Returns non-zero if the sequencer could not be serviced.
+int MultiFunction::pollPublish(int subsystem, pollData_t *pPoll)
+{
+  int status=0;
+  int i;
+  int currentPoint, lastPoint;
+  epicsUInt32 changedBits;
+  static const char *functionName = "pollerThread";
+
+  switch (subsystem) {
+    case pollSubsystemDigitalIn: {
+      epicsInt32 inputArray[MAX_IO_PORTS];
+      int changed=0;
+      for (i=0; i<numIOPorts_; i++) {
+        inputArray[i] = (epicsInt32)prevDigitalInput_[i];
+        if (digitalIOPortWriteOnly_[i]) continue;
+        changedBits = pPoll->digitalIn[i] ^ prevDigitalInput_[i];
+        if (forceCallback_[i] || (changedBits != 0)) {
+          prevDigitalInput_[i] = pPoll->digitalIn[i];
+          forceCallback_[i] = 0;
+          setUIntDigitalParam(i, digitalInput_, pPoll->digitalIn[i], 0xFFFFFFFF);
+          inputArray[i] = (epicsInt32)pPoll->digitalIn[i];
+          changed = 1;
         }
-        #ifdef _WIN32
-          // On Windows after a network glitch cbGetIOStatus will return continually return DEADDEV
-          // Need to stop and start the waveform digitizer if it was running
-          if (status == DEADDEV) {
-            stopWaveDig();
-            startWaveDig();
-          }
-          goto error;
-        #endif
-      } else {
+      }
+      // All the ports in one callback, so clients see the values from the same poll together
+      if (changed) doCallbacksInt32Array(inputArray, numIOPorts_, digitalInputArray_, 0);
+      break;
+    }
+
+    case pollSubsystemCounters:
+      for (i=0; i<numCounters_; i++) {
+        setIntegerParam(i, counterCounts_, pPoll->counts[i]);
+        updateCounterRate(i, pPoll->counts[i], pPoll->countTime[i]);
+      }
+      break;
+
+    case pollSubsystemAnalogOutScan:
+      // The scan status only applies if the same scan is still running
+      if (pPoll->aoScanSerial != aoScanSerial_) break;
+      if (waveGenRunning_) {
         asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
-          "%s::%s waveform digitizer status, aiStatus=%d, aiCount=%ld, aiIndex=%ld\n",
-          driverName, functionName, aiStatus, aiCount, aiIndex);
+          "%s::%s waveform generator status, aoStatus=%d, aoCount=%ld, aoIndex=%ld\n",
+          driverName, functionName, pPoll->aoStatus, pPoll->aoCount, pPoll->aoIndex);
+        currentPoint = (pPoll->aoIndex / numWaveGenChans_) + 1;
+        setIntegerParam(waveGenCurrentPoint_, currentPoint);
+        if ((waveGenRunState_ == waveGenStateArmed) && (pPoll->aoCount > 0)) {
+          waveGenRunState_ = waveGenStateRunning;
+          setIntegerParam(waveGenState_, waveGenRunState_);
+        }
+        if (pPoll->aoStatus == 0) {
+          stopWaveGen();
+        }
+      }
+      if (waveSeqRunning_) {
+        status = pollWaveSeq(pPoll->aoStatus, pPoll->aoTotalCount);
       }
+      break;
+
+    case pollSubsystemAnalogInScan:
+      if ((pPoll->aiScanSerial != aiScanSerial_) || !waveDigRunning_) break;
+      asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
+        "%s::%s waveform digitizer status, aiStatus=%d, aiCount=%ld, aiIndex=%ld\n",
+        driverName, functionName, pPoll->aiStatus, pPoll->aiCount, pPoll->aiIndex);
       getIntegerParam(waveDigCurrentPoint_, &currentPoint);
-      lastPoint = aiIndex / numWaveDigChans_ + 1;
+      lastPoint = pPoll->aiIndex / numWaveDigChans_ + 1;
       if (lastPoint > currentPoint) {
-        currentTime = epicsTime::getCurrent();
-        epicsTimeStamp now = (epicsTimeStamp)currentTime;
+        epicsTimeStamp now = (epicsTimeStamp)epicsTime::getCurrent();
         int firstChan;
         getIntegerParam(waveDigFirstChan_, &firstChan);
         int lastChan = firstChan + numWaveDigChans_ - 1;
@@ -2689,54 +6336,411 @@ void MultiFunction::pollerThread()
         }
         setIntegerParam(waveDigCurrentPoint_, currentPoint);
       }
-      if (aiStatus == 0) {
+      if (pPoll->aiStatus == 0) {
         stopWaveDig();
       }
-    } else {
-      // If the waveform digitizer is not running then read the analog inputs
-      int range, type, mode;
-      epicsInt32 value;
-      getIntegerParam(0, analogInMode_, &mode);
-      for (i=0; i<numAnalogIn_; i++) {
-        getIntegerParam(i, analogInRange_, &range);
-        getIntegerParam(i, analogInType_, &type);
-        if (type != AI_CHAN_TYPE_VOLTAGE) continue;
-        if ((boardType_ == E_1608) && (mode == DIFFERENTIAL) && (i>3)) break;
-        #ifdef _WIN32
-          if (ADCResolution_ <= 16) {
-            epicsUInt16 shortVal;
-            status = cbAIn(boardNum_, i, range, &shortVal);
-            value = shortVal;
-          } else {
-            ULONG ulongVal;
-            status = cbAIn32(boardNum_, i, range, &ulongVal, 0);
-            value = (epicsInt32)ulongVal;
+      break;
+
+    case pollSubsystemAnalogIn:
+      if (pPoll->analogInBackground) {
+        if ((pPoll->aiScanSerial != aiScanSerial_) || !aiBgRunning_) break;
+        if (pPoll->bgStatus == 0) {
+          // The scan stopped, for example on an overrun.  It is restarted on the next cycle.
+          reportError(-1, functionName, "Background AIn scan stopped");
+          stopAnalogInBackground();
+          break;
+        }
+        // Publish when ANALOG_IN_AVERAGE new scans are available, averaging the most recent ones
+        int newScans = (int)((pPoll->bgCount - aiBgLastCount_) / aiBgNumChans_);
+        if ((newScans < aiBgNumAverage_) || (pPoll->bgIndex < 0)) break;
+        aiBgLastCount_ += newScans * aiBgNumChans_;
+        int lastScan = (int)(pPoll->bgIndex / aiBgNumChans_);
+        for (i=0; i<aiBgNumChans_; i++) {
+          double sum = 0.;
+          for (int j=0; j<aiBgNumAverage_; j++) {
+            int pos = ((lastScan - j + aiBgRingScans_) % aiBgRingScans_) * aiBgNumChans_ + i;
+            #ifdef _WIN32
+              if (ADCResolution_ <= 16) sum += ((epicsUInt16 *)aiBgBuffer_)[pos];
+              else                      sum += ((epicsUInt32 *)aiBgBuffer_)[pos];
+            #else
+              sum += aiBgBuffer_[pos];
+            #endif
           }
-        #else
-          double data;
-          Range ulRange;
-          mapRange(range, &ulRange);
-          status = ulAIn(daqDeviceHandle_, i, aiInputMode_, ulRange, AIN_FF_NOSCALEDATA, &data);
-          value = (epicsInt32) data;
-        #endif
-        setIntegerParam(i, analogInValue_, value);
+          setIntegerParam(aiBgChan_[i], analogInValue_, (epicsInt32)floor(sum/aiBgNumAverage_ + 0.5));
+        }
+        break;
+      }
+      for (i=0; i<numAnalogIn_; i++) {
+        if (pPoll->analogInRead[i]) setIntegerParam(i, analogInValue_, pPoll->analogIn[i]);
+      }
+      break;
+
+    case pollSubsystemLogicScan:
+      if ((pPoll->logicScanSerial != logicScanSerial_) || !logicRunning_) break;
+      setIntegerParam(logicCurrentPoint_, (int)pPoll->logicCount);
+      if (pPoll->logicStatus == 0) {
+        // The capture is complete.  The scan is still stopped, as the driver must do after a BACKGROUND scan.
+        stopLogic();
+      }
+      break;
+
+    case pollSubsystemCounterScan:
+      if ((pPoll->counterScanSerial != counterScanSerial_) || !counterScanRunning_) break;
+      setIntegerParam(counterScanCurrentPoint_, (int)pPoll->counterScanCount);
+      if (pPoll->counterScanStatus == 0) {
+        // The scan is complete.  It is still stopped, as the driver must do after a BACKGROUND scan.
+        stopCounterScan();
+      } else {
+        publishCounterScan((int)pPoll->counterScanCount);
+      }
+      break;
+
+    case pollSubsystemTemperature:
+      // Settings changed while the poller was reading
+      if (pPoll->tempCacheSerial != tempCacheSerial_) break;
+      // This uses the time of the previous read so it must come before the cache is updated
+      filterTemperatures(pPoll);
+      for (i=0; i<numTempChans_ && i<MAX_TEMPERATURE_IN; i++) {
+        if (!pPoll->tempRead[i]) continue;
+        tempCache_[i] = pPoll->temperature[i];
+        tempCacheTime_[i] = pPoll->tempTime;
+        setDoubleParam(i, temperatureInValue_, tempCache_[i]);
+      }
+      break;
+
+    case pollSubsystemVoltageIn:
+      // The range changed while the poller was reading
+      if (pPoll->voltCacheSerial != voltCacheSerial_) break;
+      for (i=0; i<MAX_ANALOG_IN; i++) {
+        if (!pPoll->voltRead[i]) continue;
+        voltCache_[i] = pPoll->voltage[i];
+        voltCacheTime_[i] = pPoll->voltTime;
+        setDoubleParam(i, voltageInValue_, voltCache_[i]);
+      }
+      break;
+
+    case pollSubsystemPatternGen:
+      if ((pPoll->patternScanSerial != patternScanSerial_) || !patternRunning_) break;
+      // In continuous mode the count keeps increasing, so the position in the pattern is shown
+      setIntegerParam(patternGenCurrentPoint_,
+                      (int)(pPoll->patternCount % (patternNumPointsUsed_ > 0 ? patternNumPointsUsed_ : 1)));
+      if (pPoll->patternStatus == 0) {
+        // The one-shot pattern is complete.  It is still stopped, as the driver must do after a BACKGROUND scan.
+        stopPatternGen();
+        setIntegerParam(patternGenCurrentPoint_, patternNumPointsUsed_);
+      }
+      break;
+  }
+  return status;
+}
+
+void MultiFunction::pollerThread()
+{
+  /* This function runs in a separate thread.  Each subsystem (digital inputs, counters,
+   * AO scan status, AI scan status, single-point analog inputs, logic analyzer status,
+   * counter scan status, temperatures, voltage inputs, pattern generator status) is
+   * polled at its own POLL_PERIOD_MS, scheduled at absolute deadlines so the period does not
+   * drift with the time the polling takes.  Subsystems that are due in the same cycle are read
+   * in order of decreasing POLL_PRIORITY.  The USB transactions are done holding only the device lock
+   * and the results are staged locally, so that writes to the port are not blocked by slow
+   * input polling.  The port lock is taken at the start of the cycle to copy the settings
+   * and at the end to update the parameters and do the callbacks.
+   * The Universal Library scan events wake this thread, and the scan status subsystem that
+   * received an event is read immediately rather than at its next deadline. */
+  static const char *functionName = "pollerThread";
+  pollData_t poll;
+  int order[NUM_POLL_SUBSYSTEMS], priority[NUM_POLL_SUBSYSTEMS];
+  measCompDeadline deadline[NUM_POLL_SUBSYSTEMS];
+  epicsTime lastTime[NUM_POLL_SUBSYSTEMS];
+  int i, j, s, numDue, numSkipped, policy;
+  epicsTime startTime=epicsTime::getCurrent(), endTime, now;
+  epicsTime statsTime=startTime;
+  double sleepTime;
+  double jitterMean, jitterP99, jitterMax;
+  epicsUInt32 overruns;
+  unsigned eventFlags;
+  epicsUInt64 numEvents;
+  int eventError, woken, bgEnable;
+  int status=0, prevStatus=0;
+
+  measCompThreadApply(epicsThreadGetNameSelf());
+  for (s=0; s<NUM_POLL_SUBSYSTEMS; s++) {
+    deadline[s].restart(startTime);
+    lastTime[s] = startTime;
+  }
+
+  while(1) {
+    // Decide which subsystems are due and copy the settings that are needed for the USB transactions
+    lock();
+    endTime = epicsTime::getCurrent();
+    setDoubleParam(pollTimeMS_, (endTime-startTime)*1000.);
+    startTime = endTime;
+    now = endTime;
+    scanEventMutex_.lock();
+    eventFlags = scanEventFlags_;
+    scanEventFlags_ = 0;
+    numEvents = numScanEvents_;
+    eventError = scanEventError_;
+    scanEventMutex_.unlock();
+    setIntegerParam(scanEventCount_, (int)numEvents);
+    if (eventFlags & (scanEventInputError | scanEventOutputError)) {
+      reportError(eventError, functionName, "Scan error event");
+    }
+    // The background analog input scan runs whenever it is enabled and the digitizer is idle
+    getIntegerParam(analogInBackground_, &bgEnable);
+    if (bgEnable && !aiBgRunning_ && !aiBgFailed_ && !waveDigRunning_ && (numAnalogIn_ > 0)) {
+      startAnalogInBackground();
+    }
+    // Write the digital outputs whose coalescing window has ended
+    for (i=0; i<numIOPorts_; i++) {
+      if (doPending_[i] && (now >= doFlushTime_[i])) flushDigitalOutput(i);
+    }
+    // Restart the pulse generators whose timed commit is due
+    for (i=0; i<numTimers_; i++) {
+      int commitMode;
+      getIntegerParam(i, pulseGenCommitMode_, &commitMode);
+      if (pulseGenStaged_[i] && (commitMode == pulseCommitTimed) && (now >= pulseGenCommitTime_[i])) {
+        commitPulseGenerator(i);
+      }
+    }
+    numDue = 0;
+    for (s=0; s<NUM_POLL_SUBSYSTEMS; s++) {
+      deadline[s].setPeriod(getPollPeriod(s));
+      getIntegerParam(s, pollOverrunPolicy_, &policy);
+      deadline[s].setPolicy(policy);
+      getIntegerParam(s, pollPriority_, &priority[s]);
+      if (!pollSubsystemActive(s)) {
+        // An idle subsystem is polled as soon as it becomes active
+        deadline[s].restart(now);
+        continue;
+      }
+      woken = ((s == pollSubsystemAnalogInScan)  && (eventFlags & SCAN_EVENTS_INPUT)) ||
+              ((s == pollSubsystemAnalogOutScan) && (eventFlags & SCAN_EVENTS_OUTPUT));
+      if (woken) {
+        // Serviced now, so the next poll is one period later.  This is not counted as jitter.
+        deadline[s].restart(now + deadline[s].getPeriod());
+      } else {
+        if (!deadline[s].isDue(now)) continue;
+        deadline[s].run(now);
+      }
+      // Insert in order of decreasing priority
+      for (j=numDue; (j>0) && (priority[order[j-1]] < priority[s]); j--) order[j] = order[j-1];
+      order[j] = s;
+      numDue++;
+    }
+    poll.aoScanSerial = aoScanSerial_;
+    poll.aiScanSerial = aiScanSerial_;
+    poll.analogInBackground = aiBgRunning_;
+    poll.logicScanSerial = logicScanSerial_;
+    poll.counterScanSerial = counterScanSerial_;
+    poll.tempCacheSerial = tempCacheSerial_;
+    poll.voltCacheSerial = voltCacheSerial_;
+    poll.patternScanSerial = patternScanSerial_;
+    poll.logicPort = logicRunning_ ? logicPortIndex_ : -1;
+    getIntegerParam(0, analogInMode_, &poll.analogInMode);
+    for (i=0; i<numAnalogIn_; i++) {
+      getIntegerParam(i, analogInRange_, &poll.analogInRange[i]);
+      getIntegerParam(i, analogInType_, &poll.analogInType[i]);
+      poll.analogInRead[i] = 0;
+    }
+    for (i=0; i<numTempChans_ && i<MAX_TEMPERATURE_IN; i++) {
+      getIntegerParam(i, analogInType_, &poll.tempType[i]);
+      getIntegerParam(i, temperatureScale_, &poll.tempScale[i]);
+      getIntegerParam(i, temperatureFilter_, &poll.tempFilter[i]);
+      poll.tempRead[i] = 0;
+    }
+    for (i=0; i<MAX_ANALOG_IN; i++) {
+      poll.voltUsed[i] = voltUsed_[i];
+      getIntegerParam(i, voltageInRange_, &poll.voltRange[i]);
+      poll.voltRead[i] = 0;
+    }
+    unlock();
+
+    status = 0;
+    poll.errorMessage = 0;
+    poll.errorPort = -1;
+    poll.fatal = 0;
+    ULMutex_->lock();
+    for (i=0; i<numDue; i++) {
+      int readStatus = pollRead(order[i], &poll);
+      if (readStatus && !status) status = readStatus;
+      if (poll.fatal) {
+        // Do not publish subsystems that were not read
+        numDue = i;
+        break;
+      }
+    }
+    ULMutex_->unlock();
+
+    // Publish the results
+    lock();
+    if (status && poll.errorMessage) {
+      if (!prevStatus) {
+        reportError(status, functionName, poll.errorMessage);
+        if (poll.errorPort >= 0) asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "portNumber=%d\n", poll.errorPort);
+      }
+      #ifdef _WIN32
+        // On Windows after a network glitch cbGetIOStatus will return continually return DEADDEV
+        // Need to stop and start the waveform digitizer if it was running
+        if (waveDigRunning_ && (poll.aiScanSerial == aiScanSerial_) && (status == DEADDEV)) {
+          stopWaveDig();
+          startWaveDig();
+        }
+      #endif
+      if (poll.fatal) numDue = 0;
+    }
+
+    now = epicsTime::getCurrent();
+    for (i=0; i<numDue; i++) {
+      s = order[i];
+      if (pollPublish(s, &poll)) {
+        status = -1;
+        if (!prevStatus) {
+          reportError(status, functionName, "Calling AOutScanStatus for sequencer");
+        }
+      }
+      setDoubleParam(s, pollActualMS_, (now - lastTime[s])*1000.);
+      lastTime[s] = now;
+    }
+
+    // The jitter statistics are updated once per second
+    if ((now - statsTime) >= 1.0) {
+      for (s=0; s<NUM_POLL_SUBSYSTEMS; s++) {
+        deadline[s].stats.getStats(&jitterMean, &jitterP99, &jitterMax, &overruns);
+        setDoubleParam(s, pollJitterMeanMS_, jitterMean*1000.);
+        setDoubleParam(s, pollJitterP99MS_,  jitterP99*1000.);
+        setDoubleParam(s, pollJitterMaxMS_,  jitterMax*1000.);
+        setIntegerParam(s, pollOverruns_,    (int)overruns);
       }
+      for (i=0; i<MEAS_COMP_NUM_OPS; i++) {
+        epicsInt32 latencyCounts[MEAS_COMP_LATENCY_BINS];
+        double latencyMean, latencyMax;
+        epicsUInt32 latencyCount;
+        ulLatency_[i].getStats(&latencyMean, &latencyMax, &latencyCount);
+        setDoubleParam(i, latencyMeanUs_, latencyMean);
+        setDoubleParam(i, latencyMaxUs_,  latencyMax);
+        setIntegerParam(i, latencyCount_, (int)latencyCount);
+        ulLatency_[i].getCounts(latencyCounts);
+        doCallbacksInt32Array(latencyCounts, MEAS_COMP_LATENCY_BINS, latencyHistWF_, i);
+      }
+      statsTime = now;
     }
 
+    // Only call back the addresses that had parameters change since the last cycle.
+    // Address 0 always has the poll time.
+    numSkipped = 0;
+    for (i=1; i<MAX_SIGNALS; i++) {
+      if (!paramDirty_[i]) numSkipped++;
+    }
+    callbacksSkipped_ += numSkipped;
+    setIntegerParam(pollCallbacksSkipped_, numSkipped);
     for (i=0; i<MAX_SIGNALS; i++) {
+      if (!paramDirty_[i]) continue;
+      paramDirty_[i] = 0;
       callParamCallbacks(i);
     }
-error:
     if (prevStatus && !status) {
       reportError(-1, functionName, "Device returned to normal status");
     }
     prevStatus = status;
-    double pollTime;
-    getDoubleParam(pollSleepMS_, &pollTime);
-    ULMutex.unlock();
+
+    // Sleep until the next subsystem is due or a scan event arrives.
+    // Idle subsystems are checked at POLL_SLEEP_MS.
+    getDoubleParam(pollSleepMS_, &sleepTime);
+    sleepTime /= 1000.;
+    for (s=0; s<NUM_POLL_SUBSYSTEMS; s++) {
+      if (!pollSubsystemActive(s)) continue;
+      if (deadline[s].secondsUntilDue(now) < sleepTime) sleepTime = deadline[s].secondsUntilDue(now);
+    }
+    for (i=0; i<numIOPorts_; i++) {
+      if (doPending_[i] && ((doFlushTime_[i] - now) < sleepTime)) sleepTime = doFlushTime_[i] - now;
+    }
+    for (i=0; i<numTimers_; i++) {
+      int commitMode;
+      getIntegerParam(i, pulseGenCommitMode_, &commitMode);
+      if (pulseGenStaged_[i] && (commitMode == pulseCommitTimed) &&
+          ((pulseGenCommitTime_[i] - now) < sleepTime)) sleepTime = pulseGenCommitTime_[i] - now;
+    }
     unlock();
-    epicsThreadSleep(pollTime/1000.);
+    if (sleepTime > 0.) epicsEventWaitWithTimeout(scanEvent_, sleepTime);
+  }
+}
+
+/** Reads the first digital input port as fast as possible for the specified time,
+  * taking the device lock around each call just as the driver does.
+  * Used by MultiFunctionBenchmark to measure how USB throughput scales with the number of boards. */
+int MultiFunction::benchmark(double seconds, epicsUInt64 *pNumCalls)
+{
+  int status=0;
+  epicsUInt64 numCalls=0;
+  epicsTime startTime=epicsTime::getCurrent();
+  static const char *functionName = "benchmark";
+
+  *pNumCalls = 0;
+  if (numIOPorts_ < 1) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: ERROR device has no digital I/O ports\n",
+      driverName, functionName);
+    return -1;
+  }
+  while ((epicsTime::getCurrent() - startTime) < seconds) {
+    ULMutex_->lock();
+    #ifdef _WIN32
+      epicsUInt16 biVal16;
+      MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = cbDIn(boardNum_, digitalIOPort_[0], &biVal16));
+    #else
+      unsigned long long data;
+      MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = ulDIn(daqDeviceHandle_, (DigitalPortType)digitalIOPort_[0], &data));
+    #endif
+    ULMutex_->unlock();
+    if (status) {
+      reportError(status, functionName, "Calling DIn");
+      return status;
+    }
+    numCalls++;
   }
+  *pNumCalls = numCalls;
+  return 0;
+}
+
+// The setters mark an address dirty only when the value changes, so that the poller skips the
+// callbacks of addresses whose values were set again to the same thing.
+asynStatus MultiFunction::setIntegerParam(int list, int index, int value)
+{
+  int oldValue;
+  if ((list >= 0) && (list < MAX_SIGNALS) &&
+      ((asynPortDriver::getIntegerParam(list, index, &oldValue) != asynSuccess) || (oldValue != value)))
+    paramDirty_[list] = 1;
+  return asynPortDriver::setIntegerParam(list, index, value);
+}
+
+asynStatus MultiFunction::setDoubleParam(int list, int index, double value)
+{
+  double oldValue;
+  if ((list >= 0) && (list < MAX_SIGNALS) &&
+      ((asynPortDriver::getDoubleParam(list, index, &oldValue) != asynSuccess) || (oldValue != value)))
+    paramDirty_[list] = 1;
+  return asynPortDriver::setDoubleParam(list, index, value);
+}
+
+asynStatus MultiFunction::setUIntDigitalParam(int list, int index, epicsUInt32 value, epicsUInt32 valueMask)
+{
+  epicsUInt32 oldValue;
+  if ((list >= 0) && (list < MAX_SIGNALS) &&
+      ((asynPortDriver::getUIntDigitalParam(list, index, &oldValue, valueMask) != asynSuccess) ||
+       ((oldValue ^ value) & valueMask)))
+    paramDirty_[list] = 1;
+  return asynPortDriver::setUIntDigitalParam(list, index, value, valueMask);
+}
+
+asynStatus MultiFunction::setStringParam(int list, int index, const char *value)
+{
+  char oldValue[MAX_FILENAME_LEN];
+  if ((list >= 0) && (list < MAX_SIGNALS) &&
+      ((asynPortDriver::getStringParam(list, index, sizeof(oldValue), oldValue) != asynSuccess) ||
+       (strncmp(oldValue, value, sizeof(oldValue)) != 0)))
+    paramDirty_[list] = 1;
+  return asynPortDriver::setStringParam(list, index, value);
 }
 
 /* Report  parameters */
@@ -2779,6 +6783,25 @@ void MultiFunction::report(FILE *fp, int details)
       fprintf(fp, " %d", counts);
     }
     fprintf(fp, "\n");
+    fprintf(fp, "  poller callbacks skipped = %llu\n", (unsigned long long)callbacksSkipped_);
+    fprintf(fp, "  scan events        = %llu, AI events enabled=%d, AO events enabled=%d\n",
+            (unsigned long long)numScanEvents_, aiScanEvents_, aoScanEvents_);
+    fprintf(fp, "  AI background scan = %d, channels=%d, ring scans=%d, average=%d\n",
+            aiBgRunning_, aiBgNumChans_, aiBgRingScans_, aiBgNumAverage_);
+    for (i=0; i<numIOPorts_; i++) {
+      fprintf(fp, "  digital output shadow %d: valid=%d, value=0x%x, pending=0x%x, flushes=%d\n",
+              i, doShadowValid_[i], doShadow_[i], doPending_[i], doFlushes_[i]);
+    }
+    for (i=0; i<numTimers_; i++) {
+      fprintf(fp, "  pulse generator %d: running=%d, staged=%d\n",
+              i, pulseGenRunning_[i], pulseGenStaged_[i]);
+    }
+  }
+  if (details >= 2) {
+    fprintf(fp, "  Universal Library call latency:\n");
+    for (i=0; i<MEAS_COMP_NUM_OPS; i++) {
+      ulLatency_[i].report(fp, measCompOpNames[i]);
+    }
   }
 }
 
@@ -2790,6 +6813,103 @@ extern "C" int MultiFunctionConfig(const char *portName, const char *uniqueID,
   return asynSuccess;
 }
 
+/** Loads a user waveform file into one analog output channel in the background, called directly or from iocsh.
+  * format is 0=Auto (from the file extension), 1=Float32, 2=Float64, 3=CSV */
+extern "C" int MultiFunctionLoadWaveform(const char *portName, int channel, const char *fileName, int format)
+{
+  MultiFunction *pMultiFunction = dynamic_cast<MultiFunction *>(findAsynPortDriver(portName));
+  if (pMultiFunction == 0) {
+    printf("MultiFunctionLoadWaveform: cannot find MultiFunction port %s\n", portName);
+    return asynError;
+  }
+  if (fileName == 0) {
+    printf("MultiFunctionLoadWaveform: no file name specified\n");
+    return asynError;
+  }
+  return (pMultiFunction->queueWaveFileLoad(channel, fileName, format) == 0) ? asynSuccess : asynError;
+}
+
+#define MAX_BENCHMARK_PORTS 16
+
+typedef struct {
+  MultiFunction *pMultiFunction;
+  double seconds;
+  epicsUInt64 numCalls;
+  int status;
+  epicsEventId doneEvent;
+} benchmarkTask_t;
+
+static void benchmarkThreadC(void *pPvt)
+{
+  benchmarkTask_t *pTask = (benchmarkTask_t *)pPvt;
+  pTask->status = pTask->pMultiFunction->benchmark(pTask->seconds, &pTask->numCalls);
+  epicsEventSignal(pTask->doneEvent);
+}
+
+/** Measures Universal Library throughput for a comma-separated list of MultiFunction ports.
+  * Each port is first run alone and then all ports are run at the same time.
+  * With per-device locks the total rate should scale with the number of boards. */
+extern "C" int MultiFunctionBenchmark(const char *portNames, double seconds)
+{
+  benchmarkTask_t task[MAX_BENCHMARK_PORTS];
+  char names[256];
+  char *name, *savePtr;
+  int numPorts=0;
+  int i;
+  double aloneTotal=0., concurrentTotal=0.;
+
+  if ((portNames == 0) || (strlen(portNames) == 0)) {
+    printf("MultiFunctionBenchmark: no ports specified\n");
+    return asynError;
+  }
+  if (seconds <= 0.) seconds = 1.0;
+  strncpy(names, portNames, sizeof(names)-1);
+  names[sizeof(names)-1] = 0;
+  for (name = epicsStrtok_r(names, ", ", &savePtr); name; name = epicsStrtok_r(0, ", ", &savePtr)) {
+    if (numPorts >= MAX_BENCHMARK_PORTS) break;
+    task[numPorts].pMultiFunction = dynamic_cast<MultiFunction *>(findAsynPortDriver(name));
+    if (task[numPorts].pMultiFunction == 0) {
+      printf("MultiFunctionBenchmark: cannot find MultiFunction port %s\n", name);
+      return asynError;
+    }
+    task[numPorts].seconds = seconds;
+    numPorts++;
+  }
+  // The events are created once all the port names are known to be valid
+  for (i=0; i<numPorts; i++) {
+    task[i].doneEvent = epicsEventCreate(epicsEventEmpty);
+  }
+
+  printf("%-20s %16s %16s\n", "Port", "Alone (calls/s)", "Together (calls/s)");
+  double aloneRate[MAX_BENCHMARK_PORTS];
+  for (i=0; i<numPorts; i++) {
+    benchmarkThreadC(&task[i]);
+    epicsEventMustWait(task[i].doneEvent);
+    aloneRate[i] = task[i].status ? 0. : task[i].numCalls / seconds;
+    aloneTotal += aloneRate[i];
+  }
+  for (i=0; i<numPorts; i++) {
+    epicsThreadCreate("MultiFunctionBenchmark",
+                      epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackSmall),
+                      (EPICSTHREADFUNC)benchmarkThreadC,
+                      &task[i]);
+  }
+  for (i=0; i<numPorts; i++) {
+    double rate;
+    epicsEventMustWait(task[i].doneEvent);
+    rate = task[i].status ? 0. : task[i].numCalls / seconds;
+    concurrentTotal += rate;
+    printf("%-20s %16.1f %16.1f\n", task[i].pMultiFunction->portName, aloneRate[i], rate);
+    epicsEventDestroy(task[i].doneEvent);
+  }
+  printf("%-20s %16.1f %16.1f\n", "Total", aloneTotal, concurrentTotal);
+  if (numPorts > 0 && aloneTotal > 0.) {
+    printf("Scaling: %.2f of %d boards\n", concurrentTotal / (aloneTotal / numPorts), numPorts);
+  }
+  return asynSuccess;
+}
+
 
 static const iocshArg configArg0 = { "Port name",      iocshArgString};
 static const iocshArg configArg1 = { "UniqueID",       iocshArgString};
@@ -2806,16 +6926,68 @@ static void configCallFunc(const iocshArgBuf *args)
 }
 
 
+static const iocshArg loadWaveformArg0 = { "Port name",      iocshArgString};
+static const iocshArg loadWaveformArg1 = { "Channel",        iocshArgInt};
+static const iocshArg loadWaveformArg2 = { "File name",      iocshArgString};
+static const iocshArg loadWaveformArg3 = { "Format (0=Auto,1=Float32,2=Float64,3=CSV)", iocshArgInt};
+static const iocshArg * const loadWaveformArgs[] = {&loadWaveformArg0,
+                                                    &loadWaveformArg1,
+                                                    &loadWaveformArg2,
+                                                    &loadWaveformArg3};
+static const iocshFuncDef loadWaveformFuncDef = {"MultiFunctionLoadWaveform",4,loadWaveformArgs};
+static void loadWaveformCallFunc(const iocshArgBuf *args)
+{
+  MultiFunctionLoadWaveform(args[0].sval, args[1].ival, args[2].sval, args[3].ival);
+}
+
+
+static const iocshArg benchmarkArg0 = { "Port names",     iocshArgString};
+static const iocshArg benchmarkArg1 = { "Seconds",        iocshArgDouble};
+static const iocshArg * const benchmarkArgs[] = {&benchmarkArg0,
+                                                 &benchmarkArg1};
+static const iocshFuncDef benchmarkFuncDef = {"MultiFunctionBenchmark",2,benchmarkArgs};
+static void benchmarkCallFunc(const iocshArgBuf *args)
+{
+  MultiFunctionBenchmark(args[0].sval, args[1].dval);
+}
+
+
 static const iocshFuncDef showDevicesFuncDef = {"measCompShowDevices",0,0};
 static void showDevicesCallFunc(const iocshArgBuf *args)
 {
   measCompShowDevices();
 }
 
+
+static const iocshArg threadConfigArg0 = { "Thread name",  iocshArgString};
+static const iocshArg threadConfigArg1 = { "Policy",       iocshArgString};
+static const iocshArg threadConfigArg2 = { "Priority",     iocshArgInt};
+static const iocshArg threadConfigArg3 = { "CPUs",         iocshArgString};
+static const iocshArg * const threadConfigArgs[] = {&threadConfigArg0,
+                                                    &threadConfigArg1,
+                                                    &threadConfigArg2,
+                                                    &threadConfigArg3};
+static const iocshFuncDef threadConfigFuncDef = {"measCompThreadConfig",4,threadConfigArgs};
+static void threadConfigCallFunc(const iocshArgBuf *args)
+{
+  measCompThreadConfig(args[0].sval, args[1].sval, args[2].ival, args[3].sval);
+}
+
+
+static const iocshFuncDef threadReportFuncDef = {"measCompThreadReport",0,0};
+static void threadReportCallFunc(const iocshArgBuf *args)
+{
+  measCompThreadReport();
+}
+
 void drvMultiFunctionRegister(void)
 {
   iocshRegister(&configFuncDef,configCallFunc);
+  iocshRegister(&loadWaveformFuncDef,loadWaveformCallFunc);
+  iocshRegister(&benchmarkFuncDef,benchmarkCallFunc);
   iocshRegister(&showDevicesFuncDef,showDevicesCallFunc);
+  iocshRegister(&threadConfigFuncDef,threadConfigCallFunc);
+  iocshRegister(&threadReportFuncDef,threadReportCallFunc);
 }
 
 
@@ -30,6 +30,8 @@
 
 #include <epicsExport.h>
 #include <measCompDiscover.h>
+#include <measCompTiming.h>
+#include <measCompThreads.h>
 
 #define DRIVER_VERSION "4.2"
 
@@ -50,6 +52,17 @@ static const char *driverName = "USBCTR";
 #define driverVersionString       "DRIVER_VERSION"
 #define pollSleepMSString         "POLL_SLEEP_MS"
 #define pollTimeMSString          "POLL_TIME_MS"
+#define pollOverrunPolicyString   "POLL_OVERRUN_POLICY"
+#define pollJitterMeanMSString    "POLL_JITTER_MEAN_MS"
+#define pollJitterP99MSString     "POLL_JITTER_P99_MS"
+#define pollJitterMaxMSString     "POLL_JITTER_MAX_MS"
+#define pollOverrunsString        "POLL_OVERRUNS"
+#define latencyHistWFString       "LATENCY_HIST_WF"
+#define latencyBinsWFString       "LATENCY_BINS_WF"
+#define latencyMeanUsString       "LATENCY_MEAN_US"
+#define latencyMaxUsString        "LATENCY_MAX_US"
+#define latencyCountString        "LATENCY_COUNT"
+#define latencyResetString        "LATENCY_RESET"
 #define lastErrorMessageString    "LAST_ERROR_MESSAGE"
 
 // Pulse output parameters
@@ -129,6 +142,17 @@ protected:
   int driverVersion_;
   int pollSleepMS_;
   int pollTimeMS_;
+  int pollOverrunPolicy_;
+  int pollJitterMeanMS_;
+  int pollJitterP99MS_;
+  int pollJitterMaxMS_;
+  int pollOverruns_;
+  int latencyHistWF_;
+  int latencyBinsWF_;
+  int latencyMeanUs_;
+  int latencyMaxUs_;
+  int latencyCount_;
+  int latencyReset_;
   int lastErrorMessage_;
 
   // Pulse generator parameters
@@ -231,6 +255,8 @@ private:
   epicsTimeStamp startTime_;
   double elapsedPrevious_;
   char errorMessage_[MAX_ERROR_STRING_LEN];
+  // Latency of the Universal Library calls
+  measCompLatencyHistogram ulLatency_[MEAS_COMP_NUM_OPS];
 
   char *getErrorMessage(int error);
   int startPulseGenerator(int timerNum);
@@ -299,6 +325,17 @@ USBCTR::USBCTR(const char *portName, const char *uniqueID, int maxTimePoints, do
   createParam(driverVersionString,              asynParamOctet, &driverVersion_);
   createParam(pollSleepMSString,              asynParamFloat64, &pollSleepMS_);
   createParam(pollTimeMSString,               asynParamFloat64, &pollTimeMS_);
+  createParam(pollOverrunPolicyString,        asynParamInt32,   &pollOverrunPolicy_);
+  createParam(pollJitterMeanMSString,         asynParamFloat64, &pollJitterMeanMS_);
+  createParam(pollJitterP99MSString,          asynParamFloat64, &pollJitterP99MS_);
+  createParam(pollJitterMaxMSString,          asynParamFloat64, &pollJitterMaxMS_);
+  createParam(pollOverrunsString,             asynParamInt32,   &pollOverruns_);
+  createParam(latencyHistWFString,       asynParamInt32Array,   &latencyHistWF_);
+  createParam(latencyBinsWFString,     asynParamFloat64Array,   &latencyBinsWF_);
+  createParam(latencyMeanUsString,            asynParamFloat64, &latencyMeanUs_);
+  createParam(latencyMaxUsString,             asynParamFloat64, &latencyMaxUs_);
+  createParam(latencyCountString,             asynParamInt32,   &latencyCount_);
+  createParam(latencyResetString,             asynParamInt32,   &latencyReset_);
   createParam(lastErrorMessageString,           asynParamOctet, &lastErrorMessage_);
 
   // Pulse generator parameters
@@ -416,6 +453,7 @@ USBCTR::USBCTR(const char *portName, const char *uniqueID, int maxTimePoints, do
   // Set values of some parameters that need to be set because init record order is not predictable
   // or because the corresponding records are PINI=NO.
   setIntegerParam(pulseGenRun_, 0);
+  setIntegerParam(pollOverrunPolicy_, measCompTimingCatchUp);
   setIntegerParam(scalerDone_, 1);
   setIntegerParam(scalerChannels_, numCounters_);
   setIntegerParam(MCSMaxPoints_, maxTimePoints_);
@@ -434,7 +472,7 @@ USBCTR::USBCTR(const char *portName, const char *uniqueID, int maxTimePoints, do
   /* Start the thread to poll counters and digital inputs and do callbacks to
    * device support */
   epicsThreadCreate("USBCTRPoller",
-                    epicsThreadPriorityLow,
+                    measCompThreadPriority("USBCTRPoller", epicsThreadPriorityLow),
                     epicsThreadGetStackSize(epicsThreadStackMedium),
                     (EPICSTHREADFUNC)pollerThreadC,
                     this);
@@ -636,8 +674,8 @@ int USBCTR::startMCS()
       }
     }
     count = chanCount * numPoints;
-    status = cbDaqInScan(boardNum_, chanArray_, chanTypeArray_, gainArray_, chanCount, &rate,
-                         &pretrigCount, &count, pCountsI16_, options);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = cbDaqInScan(boardNum_, chanArray_, chanTypeArray_, gainArray_, chanCount, &rate,
+                                                                          &pretrigCount, &count, pCountsI16_, options));
     asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
       "%s::%s called cbDaqInScan, chanCount=%d, count=%ld, rate=%ld,"
       " inputMemHandle_=%p, options=0x%x, status=%d\n",
@@ -682,7 +720,7 @@ int USBCTR::startMCS()
       outChan++;
     }
     int numChans = outChan;
-    status = ulDaqInScan(daqDeviceHandle_, pDICD, numChans, numPoints, &rate, (ScanOption) options, (DaqInScanFlag) flags, pCountsF64_);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = ulDaqInScan(daqDeviceHandle_, pDICD, numChans, numPoints, &rate, (ScanOption) options, (DaqInScanFlag) flags, pCountsF64_));
     delete[] pDICD;
     if (status) {
       asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
@@ -719,11 +757,11 @@ int USBCTR::readMCS()
   getIntegerParam(mcaNumChannels_,  &numTimePoints);
   getIntegerParam(MCSPoint0Action_, &point0Action);
   #ifdef _WIN32
-    status = cbGetIOStatus(boardNum_, &ctrStatus, &ctrCount, &ctrIndex, DAQIFUNCTION);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = cbGetIOStatus(boardNum_, &ctrStatus, &ctrCount, &ctrIndex, DAQIFUNCTION));
   #else
     ScanStatus scanStatus;
     TransferStatus xferStatus;
-    status = ulDaqInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = ulDaqInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus));
     ctrStatus = scanStatus;
     ctrCount = xferStatus.currentTotalCount;
     ctrIndex = xferStatus.currentIndex;
@@ -841,9 +879,9 @@ int USBCTR::stopMCS()
     return 0;
   }
   #ifdef _WIN32
-    status = cbStopBackground(boardNum_, DAQIFUNCTION);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = cbStopBackground(boardNum_, DAQIFUNCTION));
   #else
-    status = ulDaqInScanStop(daqDeviceHandle_);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = ulDaqInScanStop(daqDeviceHandle_));
   #endif
   if (status) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
@@ -893,8 +931,8 @@ int USBCTR::startScaler()
     }
     int count = samplesPerCounter * numCounters_;
     options = BACKGROUND | CONTINUOUS | CTR64BIT | SINGLEIO;
-    status = cbCInScan(boardNum_, firstCounter, lastCounter, count, &rate,
-                       pCountsUI64_, options);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = cbCInScan(boardNum_, firstCounter, lastCounter, count, &rate,
+                                                                        pCountsUI64_, options));
     if (status) {
       asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
         "%s::%s error calling cbCInScan, firstCounter=%d, lastCounter=%d, count=%d, rate=%d, options=0x%x, status=%d, error=%s\n",
@@ -915,7 +953,7 @@ int USBCTR::startScaler()
     options = SO_CONTINUOUS | SO_SINGLEIO;
     double dblRate = (double) rate;
     CInScanFlag flags = CINSCAN_FF_CTR64_BIT;
-    status = ulCInScan(daqDeviceHandle_, firstCounter, lastCounter, samplesPerCounter, &dblRate, (ScanOption) options, flags, pCountsUI64_);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStart], status = ulCInScan(daqDeviceHandle_, firstCounter, lastCounter, samplesPerCounter, &dblRate, (ScanOption) options, flags, pCountsUI64_));
     if (status) {
       asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
         "%s::%s error calling ulCInScan, firstCounter=%d, lastCounter=%d, samplesPerCounter=%d, rate=%d, options=0x%x, flags=0x%x, status=%d, error=%s\n",
@@ -939,11 +977,11 @@ int USBCTR::readScaler()
 
   // Poll the status of the counter scan
   #ifdef _WIN32
-    status = cbGetIOStatus(boardNum_, &ctrStatus, &ctrCount, &ctrIndex, CTRFUNCTION);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = cbGetIOStatus(boardNum_, &ctrStatus, &ctrCount, &ctrIndex, CTRFUNCTION));
   #else
     ScanStatus scanStatus;
     TransferStatus xferStatus;
-    status = ulDaqInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStatus], status = ulDaqInScanStatus(daqDeviceHandle_, &scanStatus, &xferStatus));
     ctrStatus = scanStatus;
     ctrCount = xferStatus.currentTotalCount;
     ctrIndex = xferStatus.currentIndex;
@@ -980,9 +1018,9 @@ int USBCTR::stopScaler()
   static const char *functionName = "stopScaler";
 
   #ifdef _WIN32
-    status = cbStopBackground(boardNum_, CTRFUNCTION);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = cbStopBackground(boardNum_, CTRFUNCTION));
   #else
-    status = ulCInScanStop(daqDeviceHandle_);
+    MEAS_COMP_TIMED(ulLatency_[measCompOpScanStop], status = ulCInScanStop(daqDeviceHandle_));
   #endif
   if (status) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
@@ -1098,6 +1136,11 @@ asynStatus USBCTR::writeInt32(asynUser *pasynUser, epicsInt32 value)
     }
   }
 
+  if (function == latencyReset_) {
+    int op;
+    for (op=0; op<MEAS_COMP_NUM_OPS; op++) ulLatency_[op].reset();
+  }
+
   // Counter functions
   if (function == counterReset_) {
     #ifdef _WIN32
@@ -1330,9 +1373,9 @@ asynStatus USBCTR::writeUInt32Digital(asynUser *pasynUser, epicsUInt32 value, ep
       outValue = ((value &outMask) == 0) ? 0 : 1;
       if ((mask & outMask & direction) != 0) {
         #ifdef _WIN32
-          status = cbDBitOut(boardNum_, AUXPORT, i, outValue);
+          MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = cbDBitOut(boardNum_, AUXPORT, i, outValue));
         #else
-          status = ulDBitOut(daqDeviceHandle_, AUXPORT, i, outValue);
+          MEAS_COMP_TIMED(ulLatency_[measCompOpDOut], status = ulDBitOut(daqDeviceHandle_, AUXPORT, i, outValue));
         #endif
       }
     }
@@ -1455,6 +1498,13 @@ asynStatus USBCTR::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, si
     inPtr = MCSAbsTimeBuffer_;
     getIntegerParam(mcaNumChannels_, &numPoints);
   }
+  else if (function == latencyBinsWF_) {
+    // Lower edge of each latency histogram bin in microseconds
+    for (*nIn=0; (*nIn<nElements) && (*nIn<MEAS_COMP_LATENCY_BINS); (*nIn)++) {
+      value[*nIn] = measCompLatencyHistogram::binLowEdgeUs((int)*nIn);
+    }
+    return asynSuccess;
+  }
   else {
     asynPrint(pasynUser, ASYN_TRACE_ERROR,
       "%s:%s: ERROR: unknown function=%d\n",
@@ -1470,27 +1520,56 @@ asynStatus USBCTR::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, si
 
 void USBCTR::pollerThread()
 {
-  /* This function runs in a separate thread.  It waits for the poll
-   * time */
+  /* This function runs in a separate thread.  It runs every POLL_SLEEP_MS,
+   * scheduled at absolute deadlines so the period does not drift with the time
+   * the polling takes. */
   static const char *functionName = "pollerThread";
   epicsUInt32 newValue, changedBits, prevInput=0;
   epicsTime startTime=epicsTime::getCurrent(), endTime, currentTime;
+  epicsTime statsTime=startTime;
+  measCompDeadline deadline;
+  double jitterMean, jitterP99, jitterMax;
+  epicsUInt32 overruns;
+  int policy;
   unsigned short biVal;;
   int i;
   int status;
 
+  measCompThreadApply(epicsThreadGetNameSelf());
+  deadline.restart(startTime);
   while(1) {
     lock();
     endTime = epicsTime::getCurrent();
+    deadline.run(endTime);
     setDoubleParam(pollTimeMS_, (endTime-startTime)*1000.);
-    startTime = epicsTime::getCurrent();
+    startTime = endTime;
+    // The jitter statistics are updated once per second
+    if ((endTime - statsTime) >= 1.0) {
+      deadline.stats.getStats(&jitterMean, &jitterP99, &jitterMax, &overruns);
+      setDoubleParam(pollJitterMeanMS_, jitterMean*1000.);
+      setDoubleParam(pollJitterP99MS_,  jitterP99*1000.);
+      setDoubleParam(pollJitterMaxMS_,  jitterMax*1000.);
+      setIntegerParam(pollOverruns_,    (int)overruns);
+      for (i=0; i<MEAS_COMP_NUM_OPS; i++) {
+        epicsInt32 latencyCounts[MEAS_COMP_LATENCY_BINS];
+        double latencyMean, latencyMax;
+        epicsUInt32 latencyCount;
+        ulLatency_[i].getStats(&latencyMean, &latencyMax, &latencyCount);
+        setDoubleParam(i, latencyMeanUs_, latencyMean);
+        setDoubleParam(i, latencyMaxUs_,  latencyMax);
+        setIntegerParam(i, latencyCount_, (int)latencyCount);
+        ulLatency_[i].getCounts(latencyCounts);
+        doCallbacksInt32Array(latencyCounts, MEAS_COMP_LATENCY_BINS, latencyHistWF_, i);
+      }
+      statsTime = endTime;
+    }
 
     // Read the digital inputs
     #ifdef _WIN32
-      status = cbDIn(boardNum_, AUXPORT, &biVal);
+      MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = cbDIn(boardNum_, AUXPORT, &biVal));
     #else
       unsigned long long data;
-      status = ulDIn(daqDeviceHandle_, AUXPORT, &data);
+      MEAS_COMP_TIMED(ulLatency_[measCompOpDIn], status = ulDIn(daqDeviceHandle_, AUXPORT, &data));
       biVal = (unsigned short) data;
     #endif
     if (status)
@@ -1518,8 +1597,11 @@ void USBCTR::pollerThread()
     }
     double pollTime;
     getDoubleParam(pollSleepMS_, &pollTime);
+    getIntegerParam(pollOverrunPolicy_, &policy);
+    deadline.setPeriod(pollTime/1000.);
+    deadline.setPolicy(policy);
     unlock();
-    epicsThreadSleep(pollTime/1000.);
+    deadline.sleepUntilDue();
   }
 }
 
@@ -1550,6 +1632,12 @@ void USBCTR::report(FILE *fp, int details)
     getIntegerParam(MCSCurrentPoint_, &currentPoint);
     fprintf(fp, "    currentPoint: %d\n", currentPoint);
   }
+  if (details >= 2) {
+    fprintf(fp, "  Universal Library call latency:\n");
+    for (i=0; i<MEAS_COMP_NUM_OPS; i++) {
+      ulLatency_[i].report(fp, measCompOpNames[i]);
+    }
+  }
   asynPortDriver::report(fp, details);
 }
 
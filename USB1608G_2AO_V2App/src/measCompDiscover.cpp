@@ -3,6 +3,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <osiSock.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
 #ifdef _WIN32
   #include "cbw.h"
 #else
@@ -20,7 +22,55 @@ static DaqDeviceDescriptor measCompInventory[MAX_DEVICES];
 static int measCompNumDevices = 0;
 bool measCompInventoryInitialized = false;
 
-int measCompDiscoverDevices()
+// Universal Library calls to one device are serialized with that device's lock, so that
+// several boards in one IOC can do USB I/O in parallel.  The global lock is only for
+// library-wide calls: the device inventory and device creation.
+static epicsMutex *measCompLibraryLock;
+static epicsThreadOnceId measCompLockOnce = EPICS_THREAD_ONCE_INIT;
+static long long measCompLockHandle[MAX_DEVICES];
+static epicsMutex *measCompLock[MAX_DEVICES];
+static int measCompNumLocks = 0;
+
+static void measCompLockInit(void *)
+{
+  measCompLibraryLock = new epicsMutex;
+}
+
+epicsMutex *measCompGlobalLock()
+{
+  epicsThreadOnce(&measCompLockOnce, measCompLockInit, 0);
+  return measCompLibraryLock;
+}
+
+/** Returns the lock for a device, creating it the first time.
+  * \param[in] handle The handle returned by measCompCreateDevice
+  */
+epicsMutex *measCompDeviceLock(long long handle)
+{
+  epicsMutex *pLock;
+  epicsMutex *pGlobal = measCompGlobalLock();
+
+  pGlobal->lock();
+  for (int i=0; i<measCompNumLocks; i++) {
+    if (measCompLockHandle[i] == handle) {
+      pLock = measCompLock[i];
+      pGlobal->unlock();
+      return pLock;
+    }
+  }
+  if (measCompNumLocks >= MAX_DEVICES) {
+    // Should not happen, but fall back to serializing with every other device
+    pGlobal->unlock();
+    return pGlobal;
+  }
+  pLock = new epicsMutex;
+  measCompLockHandle[measCompNumLocks] = handle;
+  measCompLock[measCompNumLocks++] = pLock;
+  pGlobal->unlock();
+  return pLock;
+}
+
+static int discoverDevices()
 {
   int numDevices = MAX_DEVICES;
   int status;
@@ -60,6 +110,17 @@ int measCompDiscoverDevices()
   return 0;
 }
 
+int measCompDiscoverDevices()
+{
+  int status;
+  epicsMutex *pGlobal = measCompGlobalLock();
+
+  pGlobal->lock();
+  status = discoverDevices();
+  pGlobal->unlock();
+  return status;
+}
+
 void measCompShowDevices()
 {
   measCompDiscoverDevices();
@@ -101,7 +162,7 @@ void measCompShowDevices()
   *                         On Windows this is the index in the device inventory list.
   *                         On Linux it is a DaqDeviceHandle.
   */
-int measCompCreateDevice(std::string uniqueId, DaqDeviceDescriptor& deviceDescriptor, long long *handle)
+static int createDevice(std::string uniqueId, DaqDeviceDescriptor& deviceDescriptor, long long *handle)
 {
   size_t colon;
   std::string host = uniqueId;
@@ -115,7 +176,7 @@ int measCompCreateDevice(std::string uniqueId, DaqDeviceDescriptor& deviceDescri
   char ipAddrAsString[25];
   double timeout = 1.0;
 
-  measCompDiscoverDevices();
+  discoverDevices();
   // If the uniqueId is a hex number it is USB, else Ethernet
   strtol(uniqueId.c_str(), &endptr, 16);
   if (*endptr != '\0') isEthernet = true;
@@ -207,3 +268,14 @@ int measCompCreateDevice(std::string uniqueId, DaqDeviceDescriptor& deviceDescri
   return -1;
 }
 
+int measCompCreateDevice(std::string uniqueId, DaqDeviceDescriptor& deviceDescriptor, long long *handle)
+{
+  int status;
+  epicsMutex *pGlobal = measCompGlobalLock();
+
+  pGlobal->lock();
+  status = createDevice(uniqueId, deviceDescriptor, handle);
+  pGlobal->unlock();
+  return status;
+}
+
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <shareLib.h>
+#include <epicsMutex.h>
 #ifdef _WIN32
   #include "cbw.h"
 #else
@@ -12,5 +13,7 @@
 epicsShareFunc int measCompDiscoverDevices();
 epicsShareFunc void measCompShowDevices();
 epicsShareFunc int measCompCreateDevice(std::string uniqueId, DaqDeviceDescriptor& deviceDescriptor, long long *handle);
+epicsShareFunc epicsMutex *measCompDeviceLock(long long handle);
+epicsShareFunc epicsMutex *measCompGlobalLock();
 
 #endif /* measCompDiscoverInclude */
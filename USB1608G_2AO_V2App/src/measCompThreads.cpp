@@ -0,0 +1,338 @@
+/* measCompThreads.cpp
+ *
+ * Scheduling policy, priority and CPU affinity of the threads
+ * of the Measurement Computing drivers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <sched.h>
+#endif
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsString.h>
+#include <epicsStdio.h>
+
+#include <measCompThreads.h>
+
+#define MAX_THREAD_NAME 64
+#define MAX_CPUS        64
+
+typedef enum {
+  threadPolicyDefault,
+  threadPolicyOther,
+  threadPolicyFifo,
+  threadPolicyRR
+} threadPolicy_t;
+
+static const char *policyNames[] = {"DEFAULT", "OTHER", "FIFO", "RR"};
+
+typedef struct {
+  char name[MAX_THREAD_NAME];
+  int policy;
+  int priority;
+  epicsUInt64 cpuMask;
+} threadConfig_t;
+
+typedef struct {
+  char name[MAX_THREAD_NAME];
+  int policy;
+  int osPriority;
+  epicsUInt64 cpuMask;
+  char result[80];
+} threadApplied_t;
+
+static threadConfig_t threadConfig[MEAS_COMP_MAX_THREAD_CONFIGS];
+static int numThreadConfigs;
+static threadApplied_t threadApplied[MEAS_COMP_MAX_THREADS];
+static int numThreadsApplied;
+static epicsMutex *threadMutex;
+static epicsThreadOnceId threadOnceId = EPICS_THREAD_ONCE_INIT;
+
+static int parsePolicy(const char *policy)
+{
+  int i;
+
+  if ((policy == 0) || (strlen(policy) == 0)) return threadPolicyDefault;
+  for (i=0; i<(int)(sizeof(policyNames)/sizeof(policyNames[0])); i++) {
+    if (epicsStrCaseCmp(policy, policyNames[i]) == 0) return i;
+  }
+  return -1;
+}
+
+// Converts a list such as "0-3,6" into a bit mask.  Returns -1 if the list is not valid.
+static int parseCpus(const char *cpus, epicsUInt64 *pMask)
+{
+  const char *p = cpus;
+  char *end;
+  long first, last, cpu;
+
+  *pMask = 0;
+  if (p == 0) return 0;
+  while (*p) {
+    if ((*p == ',') || (*p == ' ')) {
+      p++;
+      continue;
+    }
+    first = strtol(p, &end, 10);
+    if (end == p) return -1;
+    last = first;
+    p = end;
+    if (*p == '-') {
+      p++;
+      last = strtol(p, &end, 10);
+      if (end == p) return -1;
+      p = end;
+    }
+    if ((first < 0) || (last >= MAX_CPUS) || (last < first)) return -1;
+    for (cpu=first; cpu<=last; cpu++) *pMask |= ((epicsUInt64)1 << cpu);
+  }
+  return 0;
+}
+
+static void formatCpus(epicsUInt64 mask, char *buffer, size_t size)
+{
+  int cpu;
+  size_t len=0;
+
+  buffer[0] = 0;
+  if (mask == 0) {
+    epicsSnprintf(buffer, size, "any");
+    return;
+  }
+  for (cpu=0; (cpu<MAX_CPUS) && (len<size); cpu++) {
+    if (!(mask & ((epicsUInt64)1 << cpu))) continue;
+    len += epicsSnprintf(buffer+len, size-len, "%s%d", len ? "," : "", cpu);
+  }
+}
+
+static int addConfig(const char *threadName, const char *policy, int priority, const char *cpus)
+{
+  threadConfig_t *pConfig=0;
+  int policyValue;
+  epicsUInt64 cpuMask;
+  int i;
+
+  if ((threadName == 0) || (strlen(threadName) == 0) || (strlen(threadName) >= MAX_THREAD_NAME)) {
+    printf("measCompThreadConfig: invalid thread name\n");
+    return -1;
+  }
+  policyValue = parsePolicy(policy);
+  if (policyValue < 0) {
+    printf("measCompThreadConfig: unknown policy %s, must be DEFAULT, OTHER, FIFO or RR\n", policy);
+    return -1;
+  }
+  if ((priority < -1) || (priority > epicsThreadPriorityMax)) {
+    printf("measCompThreadConfig: priority %d must be -1 or 0-%d\n", priority, epicsThreadPriorityMax);
+    return -1;
+  }
+  if (parseCpus(cpus, &cpuMask)) {
+    printf("measCompThreadConfig: invalid CPU list %s\n", cpus);
+    return -1;
+  }
+  // A new setting for the same name replaces the old one
+  for (i=0; i<numThreadConfigs; i++) {
+    if (strcmp(threadConfig[i].name, threadName) == 0) pConfig = &threadConfig[i];
+  }
+  if (pConfig == 0) {
+    if (numThreadConfigs >= MEAS_COMP_MAX_THREAD_CONFIGS) {
+      printf("measCompThreadConfig: too many thread settings, maximum=%d\n", MEAS_COMP_MAX_THREAD_CONFIGS);
+      return -1;
+    }
+    pConfig = &threadConfig[numThreadConfigs++];
+  }
+  strcpy(pConfig->name, threadName);
+  pConfig->policy = policyValue;
+  pConfig->priority = priority;
+  pConfig->cpuMask = cpuMask;
+  return 0;
+}
+
+// Reads the settings in MEASCOMP_THREADS, "name=policy:priority:cpus;..."
+static void threadInit(void *)
+{
+  const char *env;
+  char *copy, *entry, *saveEntry, *field, *saveField;
+  char *name, *policy, *cpus;
+  int priority;
+
+  threadMutex = new epicsMutex();
+  env = getenv("MEASCOMP_THREADS");
+  if ((env == 0) || (strlen(env) == 0)) return;
+  copy = epicsStrDup(env);
+  for (entry = epicsStrtok_r(copy, ";", &saveEntry); entry; entry = epicsStrtok_r(0, ";", &saveEntry)) {
+    name = epicsStrtok_r(entry, "=", &saveField);
+    field = epicsStrtok_r(0, "", &saveField);
+    if ((name == 0) || (field == 0)) {
+      printf("measCompThreads: invalid MEASCOMP_THREADS entry %s\n", entry);
+      continue;
+    }
+    policy = field;
+    priority = -1;
+    cpus = 0;
+    field = strchr(policy, ':');
+    if (field) {
+      *field++ = 0;
+      priority = atoi(field);
+      cpus = strchr(field, ':');
+      if (cpus) cpus++;
+    }
+    addConfig(name, policy, priority, cpus);
+  }
+  free(copy);
+}
+
+static void threadInitOnce()
+{
+  epicsThreadOnce(&threadOnceId, threadInit, 0);
+}
+
+// Returns the setting for a thread: the longest matching name, or "*".  Called with threadMutex locked.
+static threadConfig_t *findConfig(const char *threadName)
+{
+  threadConfig_t *pBest=0;
+  size_t bestLen=0, len;
+  int i;
+
+  for (i=0; i<numThreadConfigs; i++) {
+    if (strcmp(threadConfig[i].name, "*") == 0) {
+      if (pBest == 0) pBest = &threadConfig[i];
+      continue;
+    }
+    len = strlen(threadConfig[i].name);
+    if ((strncmp(threadConfig[i].name, threadName, len) == 0) && (len > bestLen)) {
+      pBest = &threadConfig[i];
+      bestLen = len;
+    }
+  }
+  return pBest;
+}
+
+epicsShareFunc int measCompThreadConfig(const char *threadName, const char *policy, int priority, const char *cpus)
+{
+  int status;
+
+  threadInitOnce();
+  threadMutex->lock();
+  status = addConfig(threadName, policy, priority, cpus);
+  threadMutex->unlock();
+  return status;
+}
+
+epicsShareFunc unsigned int measCompThreadPriority(const char *threadName, unsigned int defaultPriority)
+{
+  threadConfig_t *pConfig;
+  unsigned int priority = defaultPriority;
+
+  threadInitOnce();
+  threadMutex->lock();
+  pConfig = findConfig(threadName);
+  if (pConfig && (pConfig->priority >= 0)) priority = pConfig->priority;
+  threadMutex->unlock();
+  return priority;
+}
+
+epicsShareFunc void measCompThreadApply(const char *threadName)
+{
+  threadConfig_t config;
+  threadConfig_t *pConfig;
+  threadApplied_t *pApplied;
+  int osPriority=-1;
+  char result[80];
+
+  threadInitOnce();
+  threadMutex->lock();
+  pConfig = findConfig(threadName);
+  if (pConfig) config = *pConfig;
+  threadMutex->unlock();
+  if (pConfig == 0) return;
+
+  strcpy(result, "OK");
+  #ifdef _WIN32
+    // Windows has no real-time policies.  The EPICS priority was set when the thread was created.
+    if ((config.policy == threadPolicyFifo) || (config.policy == threadPolicyRR)) {
+      strcpy(result, "policy not supported on Windows");
+    }
+    if (config.cpuMask != 0) {
+      if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)config.cpuMask) == 0) {
+        epicsSnprintf(result, sizeof(result), "SetThreadAffinityMask error %lu", GetLastError());
+      }
+    }
+  #else
+    if (config.policy != threadPolicyDefault) {
+      struct sched_param param;
+      int policy = (config.policy == threadPolicyFifo) ? SCHED_FIFO :
+                   (config.policy == threadPolicyRR)   ? SCHED_RR   : SCHED_OTHER;
+      int minPriority = sched_get_priority_min(policy);
+      int maxPriority = sched_get_priority_max(policy);
+      // The EPICS priority range 0-99 is mapped onto the range of the policy
+      int priority = (config.priority >= 0) ? config.priority : epicsThreadGetPrioritySelf();
+      osPriority = minPriority + (priority * (maxPriority - minPriority)) / epicsThreadPriorityMax;
+      memset(&param, 0, sizeof(param));
+      param.sched_priority = osPriority;
+      int status = pthread_setschedparam(pthread_self(), policy, &param);
+      if (status) {
+        epicsSnprintf(result, sizeof(result), "pthread_setschedparam: %s", strerror(status));
+      }
+    }
+    if (config.cpuMask != 0) {
+      cpu_set_t cpuSet;
+      int cpu;
+      CPU_ZERO(&cpuSet);
+      for (cpu=0; cpu<MAX_CPUS; cpu++) {
+        if (config.cpuMask & ((epicsUInt64)1 << cpu)) CPU_SET(cpu, &cpuSet);
+      }
+      int status = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+      if (status) {
+        epicsSnprintf(result, sizeof(result), "pthread_setaffinity_np: %s", strerror(status));
+      }
+    }
+  #endif
+  if (strcmp(result, "OK") != 0) {
+    printf("measCompThreadApply: thread %s: %s\n", threadName, result);
+  }
+
+  threadMutex->lock();
+  if (numThreadsApplied < MEAS_COMP_MAX_THREADS) {
+    pApplied = &threadApplied[numThreadsApplied++];
+    strncpy(pApplied->name, threadName, MAX_THREAD_NAME-1);
+    pApplied->name[MAX_THREAD_NAME-1] = 0;
+    pApplied->policy = config.policy;
+    pApplied->osPriority = osPriority;
+    pApplied->cpuMask = config.cpuMask;
+    strcpy(pApplied->result, result);
+  }
+  threadMutex->unlock();
+}
+
+epicsShareFunc void measCompThreadReport()
+{
+  char cpus[200];
+  int i;
+
+  threadInitOnce();
+  threadMutex->lock();
+  printf("Thread settings:\n");
+  if (numThreadConfigs == 0) printf("  none, all threads use their default priority\n");
+  for (i=0; i<numThreadConfigs; i++) {
+    formatCpus(threadConfig[i].cpuMask, cpus, sizeof(cpus));
+    printf("  %-24s policy=%-7s priority=%3d cpus=%s\n",
+           threadConfig[i].name, policyNames[threadConfig[i].policy], threadConfig[i].priority, cpus);
+  }
+  printf("Applied to threads:\n");
+  for (i=0; i<numThreadsApplied; i++) {
+    formatCpus(threadApplied[i].cpuMask, cpus, sizeof(cpus));
+    printf("  %-24s policy=%-7s OS priority=%3d cpus=%s result=%s\n",
+           threadApplied[i].name, policyNames[threadApplied[i].policy], threadApplied[i].osPriority,
+           cpus, threadApplied[i].result);
+  }
+  threadMutex->unlock();
+}
@@ -0,0 +1,24 @@
+#ifndef measCompThreadsInclude
+#define measCompThreadsInclude
+
+#include <shareLib.h>
+
+// Maximum number of thread settings and of threads recorded for measCompThreadReport
+#define MEAS_COMP_MAX_THREAD_CONFIGS 32
+#define MEAS_COMP_MAX_THREADS        64
+
+/* Scheduling settings for the driver threads.
+ * A setting applies to every thread whose name starts with threadName, or to all driver threads
+ * if threadName is "*".  policy is "DEFAULT", "OTHER", "FIFO" or "RR", priority is an EPICS priority
+ * (0-99, or -1 to keep the default), and cpus is a list such as "2,3" or "0-3" (empty for no affinity).
+ * Settings can also be given before iocInit in the MEASCOMP_THREADS environment variable as
+ * "name=policy:priority:cpus;name=policy:priority:cpus". */
+epicsShareFunc int measCompThreadConfig(const char *threadName, const char *policy, int priority, const char *cpus);
+// Returns the EPICS priority to create a thread with: the configured one, or defaultPriority
+epicsShareFunc unsigned int measCompThreadPriority(const char *threadName, unsigned int defaultPriority);
+// Applies the configured policy, priority and affinity to the calling thread, which is named threadName
+epicsShareFunc void measCompThreadApply(const char *threadName);
+// Prints the settings and what was applied to each thread
+epicsShareFunc void measCompThreadReport();
+
+#endif /* measCompThreadsInclude */
@@ -0,0 +1,212 @@
+/* measCompTiming.cpp
+ *
+ * Absolute-deadline scheduling and jitter statistics for the polling threads
+ * of the Measurement Computing drivers, and latency histograms of the
+ * Universal Library calls.
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#include <epicsThread.h>
+#include <epicsAtomic.h>
+
+#include <measCompTiming.h>
+
+measCompJitterStats::measCompJitterStats()
+{
+  reset();
+}
+
+void measCompJitterStats::reset()
+{
+  numSamples_ = 0;
+  nextSample_ = 0;
+  overruns_ = 0;
+}
+
+void measCompJitterStats::addSample(double lateness)
+{
+  samples_[nextSample_] = lateness;
+  nextSample_ = (nextSample_ + 1) % MEAS_COMP_JITTER_SAMPLES;
+  if (numSamples_ < MEAS_COMP_JITTER_SAMPLES) numSamples_++;
+}
+
+void measCompJitterStats::addOverruns(int count)
+{
+  overruns_ += count;
+}
+
+/** Returns the mean, 99th percentile and maximum lateness in seconds, and the total number of overruns. */
+void measCompJitterStats::getStats(double *pMean, double *pP99, double *pMax, epicsUInt32 *pOverruns)
+{
+  double sorted[MEAS_COMP_JITTER_SAMPLES];
+  double sum=0., max=0.;
+  int i, n99;
+
+  *pOverruns = overruns_;
+  if (numSamples_ == 0) {
+    *pMean = *pP99 = *pMax = 0.;
+    return;
+  }
+  for (i=0; i<numSamples_; i++) {
+    sum += samples_[i];
+    if (samples_[i] > max) max = samples_[i];
+  }
+  memcpy(sorted, samples_, numSamples_*sizeof(double));
+  n99 = (numSamples_ * 99) / 100;
+  std::nth_element(sorted, sorted + n99, sorted + numSamples_);
+  *pMean = sum / numSamples_;
+  *pP99 = sorted[n99];
+  *pMax = max;
+}
+
+measCompDeadline::measCompDeadline()
+  : deadline_(epicsTime::getCurrent()),
+    period_(1.0),
+    policy_(measCompTimingCatchUp)
+{
+}
+
+/** Makes the task due now, e.g. when it becomes active.  No lateness is recorded. */
+void measCompDeadline::restart(const epicsTime &now)
+{
+  deadline_ = now;
+}
+
+/** Changes the period.  The next deadline is moved so that it is one new period after the last one. */
+void measCompDeadline::setPeriod(double period)
+{
+  if (period <= 0.) return;
+  deadline_ += period - period_;
+  period_ = period;
+}
+
+void measCompDeadline::setPolicy(int policy)
+{
+  policy_ = policy;
+}
+
+double measCompDeadline::getPeriod()
+{
+  return period_;
+}
+
+bool measCompDeadline::isDue(const epicsTime &now)
+{
+  return (now >= deadline_);
+}
+
+double measCompDeadline::secondsUntilDue(const epicsTime &now)
+{
+  return deadline_ - now;
+}
+
+/** Called when the task runs.  Records how late it is and advances the deadline.
+  * Each run that starts a whole period or more after its deadline counts as one overrun. */
+void measCompDeadline::run(const epicsTime &now)
+{
+  double lateness = now - deadline_;
+  int missed;
+
+  if (lateness < 0.) lateness = 0.;
+  stats.addSample(lateness);
+  missed = (int)(lateness / period_);
+  if (missed > 0) stats.addOverruns(1);
+  if ((policy_ == measCompTimingSkip) || (missed > MEAS_COMP_MAX_CATCH_UP)) {
+    deadline_ += (missed + 1) * period_;
+  } else {
+    deadline_ += period_;
+  }
+}
+
+/** Sleeps until the deadline, for tasks that have their own thread. */
+void measCompDeadline::sleepUntilDue()
+{
+  double delay = secondsUntilDue(epicsTime::getCurrent());
+  if (delay > 0.) epicsThreadSleep(delay);
+}
+
+const char *measCompOpNames[MEAS_COMP_NUM_OPS] = {
+  "DIn", "CIn", "AIn", "TIn", "AOut", "DOut", "ScanStatus", "ScanStart", "ScanStop"
+};
+
+measCompLatencyHistogram::measCompLatencyHistogram()
+{
+  reset();
+}
+
+void measCompLatencyHistogram::reset()
+{
+  int i;
+
+  for (i=0; i<MEAS_COMP_LATENCY_BINS; i++) epicsAtomicSetSizeT(&counts_[i], 0);
+  epicsAtomicSetSizeT(&numSamples_, 0);
+  epicsAtomicSetSizeT(&sumUs_, 0);
+  epicsAtomicSetIntT(&maxUs_, 0);
+}
+
+void measCompLatencyHistogram::addSample(epicsUInt64 nanoseconds)
+{
+  epicsUInt64 us = nanoseconds/1000;
+  int bin=0;
+  int prevMax;
+
+  while ((us >> bin) && (bin < MEAS_COMP_LATENCY_BINS-1)) bin++;
+  epicsAtomicIncrSizeT(&counts_[bin]);
+  epicsAtomicIncrSizeT(&numSamples_);
+  epicsAtomicAddSizeT(&sumUs_, (size_t)us);
+  if (us > 0x7fffffff) us = 0x7fffffff;
+  // Another thread may raise the maximum between the read and the swap, so retry until it sticks
+  prevMax = epicsAtomicGetIntT(&maxUs_);
+  while ((int)us > prevMax) {
+    int current = epicsAtomicCmpAndSwapIntT(&maxUs_, prevMax, (int)us);
+    if (current == prevMax) break;
+    prevMax = current;
+  }
+}
+
+void measCompLatencyHistogram::getCounts(epicsInt32 *counts)
+{
+  int i;
+
+  for (i=0; i<MEAS_COMP_LATENCY_BINS; i++) counts[i] = (epicsInt32)epicsAtomicGetSizeT(&counts_[i]);
+}
+
+/** Returns the mean and maximum latency in microseconds and the number of calls since the last reset. */
+void measCompLatencyHistogram::getStats(double *pMeanUs, double *pMaxUs, epicsUInt32 *pCount)
+{
+  size_t numSamples = epicsAtomicGetSizeT(&numSamples_);
+
+  *pCount = (epicsUInt32)numSamples;
+  *pMeanUs = numSamples ? (double)epicsAtomicGetSizeT(&sumUs_)/numSamples : 0.;
+  *pMaxUs = epicsAtomicGetIntT(&maxUs_);
+}
+
+double measCompLatencyHistogram::binLowEdgeUs(int bin)
+{
+  if (bin <= 0) return 0.;
+  return (double)((epicsUInt64)1 << (bin-1));
+}
+
+/** Prints the statistics and the bins that have counts */
+void measCompLatencyHistogram::report(FILE *fp, const char *name)
+{
+  epicsInt32 counts[MEAS_COMP_LATENCY_BINS];
+  double mean, max;
+  epicsUInt32 numSamples;
+  int i;
+
+  getStats(&mean, &max, &numSamples);
+  fprintf(fp, "    %-10s calls=%u, mean=%.1f us, max=%.0f us\n", name, numSamples, mean, max);
+  if (numSamples == 0) return;
+  getCounts(counts);
+  for (i=0; i<MEAS_COMP_LATENCY_BINS; i++) {
+    if (counts[i] == 0) continue;
+    if (i == MEAS_COMP_LATENCY_BINS-1) {
+      fprintf(fp, "      >= %8.0f us: %d\n", binLowEdgeUs(i), counts[i]);
+    } else {
+      fprintf(fp, "      %8.0f - %8.0f us: %d\n", binLowEdgeUs(i), binLowEdgeUs(i+1), counts[i]);
+    }
+  }
+}
@@ -0,0 +1,106 @@
+#ifndef measCompTimingInclude
+#define measCompTimingInclude
+
+#include <stdio.h>
+
+#include <epicsTime.h>
+#include <epicsTypes.h>
+#include <shareLib.h>
+
+// What a periodic task does when it has missed one or more deadlines
+typedef enum {
+  measCompTimingCatchUp,  // Run the missed periods back to back until it is on schedule again
+  measCompTimingSkip      // Drop the missed periods and resume at the next deadline in the future
+} measCompTimingPolicy_t;
+
+// Number of recent lateness samples used for the jitter statistics
+#define MEAS_COMP_JITTER_SAMPLES 1024
+// A task that is further behind than this many periods is resynchronized even with measCompTimingCatchUp
+#define MEAS_COMP_MAX_CATCH_UP   10
+
+/** Jitter and overrun statistics of a periodic task.
+  * The mean, 99th percentile and maximum are computed over the last MEAS_COMP_JITTER_SAMPLES runs. */
+class epicsShareClass measCompJitterStats {
+public:
+  measCompJitterStats();
+  void addSample(double lateness);
+  void addOverruns(int count);
+  void getStats(double *pMean, double *pP99, double *pMax, epicsUInt32 *pOverruns);
+  void reset();
+
+private:
+  double samples_[MEAS_COMP_JITTER_SAMPLES];
+  int numSamples_;
+  int nextSample_;
+  epicsUInt32 overruns_;
+};
+
+/** Schedules a periodic task at absolute deadlines, so that the period does not drift with the time
+  * the task takes.  The lateness of each run relative to its deadline is recorded in stats. */
+class epicsShareClass measCompDeadline {
+public:
+  measCompDeadline();
+  void restart(const epicsTime &now);
+  void setPeriod(double period);
+  void setPolicy(int policy);
+  double getPeriod();
+  bool isDue(const epicsTime &now);
+  double secondsUntilDue(const epicsTime &now);
+  void run(const epicsTime &now);
+  void sleepUntilDue();
+  measCompJitterStats stats;
+
+private:
+  epicsTime deadline_;
+  double period_;
+  int policy_;
+};
+
+// Universal Library operations whose call latency is recorded
+typedef enum {
+  measCompOpDIn,
+  measCompOpCIn,
+  measCompOpAIn,
+  measCompOpTIn,
+  measCompOpAOut,
+  measCompOpDOut,
+  measCompOpScanStatus,
+  measCompOpScanStart,
+  measCompOpScanStop,
+  MEAS_COMP_NUM_OPS
+} measCompOp_t;
+
+epicsShareExtern const char *measCompOpNames[MEAS_COMP_NUM_OPS];
+
+// Number of latency histogram bins.  Bin 0 is below 1 us, bin i covers 2^(i-1) to 2^i us,
+// and the last bin collects everything from 2^(MEAS_COMP_LATENCY_BINS-2) us (about 4 s) up.
+#define MEAS_COMP_LATENCY_BINS 24
+
+/** Log-scale histogram of call latencies.  addSample only uses atomic operations, so it can be
+  * called from any thread without a lock while another thread reads the histogram. */
+class epicsShareClass measCompLatencyHistogram {
+public:
+  measCompLatencyHistogram();
+  void addSample(epicsUInt64 nanoseconds);
+  void getCounts(epicsInt32 *counts);
+  void getStats(double *pMeanUs, double *pMaxUs, epicsUInt32 *pCount);
+  void reset();
+  void report(FILE *fp, const char *name);
+  static double binLowEdgeUs(int bin);
+
+private:
+  size_t counts_[MEAS_COMP_LATENCY_BINS];
+  size_t numSamples_;
+  size_t sumUs_;
+  int maxUs_;
+};
+
+// Times the statement call and adds its duration to histogram
+#define MEAS_COMP_TIMED(histogram, call)                              \
+  do {                                                                \
+    epicsUInt64 measCompStart_ = epicsMonotonicGet();                 \
+    call;                                                             \
+    (histogram).addSample(epicsMonotonicGet() - measCompStart_);      \
+  } while (0)
+
+#endif /* measCompTimingInclude */
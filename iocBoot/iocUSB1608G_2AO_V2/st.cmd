@@ -12,6 +12,11 @@ epicsEnvSet("WDIG_POINTS", "1048576")
 epicsEnvSet("WGEN_POINTS", "1048576")
 epicsEnvSet("UNIQUE_ID", "01D97CFA")
 
+## Optional scheduling policy, priority and CPU affinity of the driver threads
+## (thread name prefix or "*", DEFAULT/OTHER/FIFO/RR, EPICS priority or -1, CPU list)
+#measCompThreadConfig("MultiFunctionPoller", "FIFO", 80, "2")
+#measCompThreadConfig("ThresholdMonitor", "FIFO", 70, "2")
+
 ## Configure port driver
 MultiFunctionConfig("$(PORT)", "$(UNIQUE_ID)", $(WDIG_POINTS), $(WGEN_POINTS))
 